@@ -0,0 +1,312 @@
+/*
+ * In-network aggregation toward a sink. The sink and every node attached to
+ * it send a single hop beacon with their depth once per period, and nodes
+ * take the shallowest neighbor as their parent. Reports travel one hop at a
+ * time, so the traffic toward the sink follows the depth of the tree rather
+ * than the number of nodes.
+ */
+
+#include <zephyr.h>
+#include <string.h>
+#include <sys/printk.h>
+#include <random/rand32.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/mesh.h>
+
+#include "mesh.h"
+#include "mesh_app.h"
+#include "aggregate.h"
+#include "gateway.h"
+
+#define AGGREGATE_PERIOD_MS	(HEARTBEAT_PERIOD_SEC * MSEC_PER_SEC)
+#define AGGREGATE_JITTER_MS	500
+
+/* Beyond this the tree lost its sink and is counting to infinity */
+#define AGGREGATE_DEPTH_MAX	16
+
+/* Periods without a beacon before the parent is dropped */
+#define PARENT_TIMEOUT_PERIODS	3
+
+/* Periods a child report is merged for, after that the child moved away */
+#define CHILD_TIMEOUT_PERIODS	2
+
+/* Stronger signal needed to switch between parents of the same depth */
+#define PARENT_RSSI_HYSTERESIS	6
+
+#define CHILDREN_MAX		MAX_NODES
+
+struct child {
+	uint16_t addr;
+	uint32_t last_rx;
+	struct aggregate_report report;
+};
+
+static struct {
+	uint16_t addr;
+	uint16_t sink;
+	uint8_t depth;
+	int8_t rssi;
+	uint32_t last_rx;
+} parent;
+
+static bool is_sink;
+static struct child children[CHILDREN_MAX];
+
+/* Reused for every period, too big for the work queue stack */
+static struct aggregate_report report;
+static struct aggregate_report view;
+
+static struct k_delayed_work period_work;
+
+static bool parent_valid(uint32_t now)
+{
+	return parent.addr != BT_MESH_ADDR_UNASSIGNED &&
+	       now - parent.last_rx <
+	       PARENT_TIMEOUT_PERIODS * AGGREGATE_PERIOD_MS;
+}
+
+static uint8_t own_depth(uint32_t now)
+{
+	if (is_sink) {
+		return 0;
+	}
+
+	if (!parent_valid(now)) {
+		return AGGREGATE_DEPTH_NONE;
+	}
+
+	return parent.depth + 1;
+}
+
+void aggregate_beacon_recv(uint16_t addr, uint16_t sink, uint8_t depth,
+			   uint16_t parent_addr, int8_t rssi)
+{
+	uint32_t now = k_uptime_get_32();
+
+	if (is_sink || depth >= AGGREGATE_DEPTH_MAX) {
+		return;
+	}
+
+	/* Our own children can't lead us to the sink */
+	if (parent_addr == mesh_get_addr()) {
+		if (addr == parent.addr) {
+			parent.addr = BT_MESH_ADDR_UNASSIGNED;
+		}
+
+		return;
+	}
+
+	if (addr != parent.addr && parent_valid(now) &&
+	    (depth > parent.depth ||
+	     (depth == parent.depth &&
+	      rssi < parent.rssi + PARENT_RSSI_HYSTERESIS))) {
+		return;
+	}
+
+	if (addr != parent.addr) {
+		printk("Aggregation parent 0x%04x depth %u\n", addr, depth);
+	}
+
+	parent.addr = addr;
+	parent.sink = sink;
+	parent.depth = depth;
+	parent.rssi = rssi;
+	parent.last_rx = now;
+}
+
+void aggregate_report_recv(uint16_t addr, const struct aggregate_report *r)
+{
+	struct child *slot = &children[0];
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(children); i++) {
+		if (children[i].addr == addr) {
+			slot = &children[i];
+			break;
+		}
+
+		/* Otherwise replace the stalest one */
+		if (children[i].last_rx < slot->last_rx) {
+			slot = &children[i];
+		}
+	}
+
+	slot->addr = addr;
+	slot->last_rx = k_uptime_get_32();
+	memcpy(&slot->report, r, sizeof(slot->report));
+}
+
+static void report_add_edge(struct aggregate_report *r, uint16_t a,
+			    uint16_t b, uint8_t distance)
+{
+	int i;
+
+	/* Both ends report the edge, keep it once */
+	if (a > b) {
+		uint16_t tmp = a;
+
+		a = b;
+		b = tmp;
+	}
+
+	for (i = 0; i < r->edge_count; i++) {
+		if (r->edges[i].a == a && r->edges[i].b == b) {
+			return;
+		}
+	}
+
+	if (r->edge_count == ARRAY_SIZE(r->edges)) {
+		return;
+	}
+
+	r->edges[r->edge_count].a = a;
+	r->edges[r->edge_count].b = b;
+	r->edges[r->edge_count].distance = distance;
+	r->edge_count++;
+}
+
+static void report_merge(struct aggregate_report *dst,
+			 const struct aggregate_report *src)
+{
+	int i;
+
+	if (!src->nodes) {
+		return;
+	}
+
+	if (!dst->nodes) {
+		dst->temp_min = src->temp_min;
+		dst->temp_max = src->temp_max;
+	} else {
+		dst->temp_min = MIN(dst->temp_min, src->temp_min);
+		dst->temp_max = MAX(dst->temp_max, src->temp_max);
+	}
+
+	dst->nodes = MIN(dst->nodes + src->nodes, UINT8_MAX);
+	dst->temp_sum += src->temp_sum;
+
+	for (i = 0; i < src->edge_count; i++) {
+		report_add_edge(dst, src->edges[i].a, src->edges[i].b,
+				src->edges[i].distance);
+	}
+}
+
+static void report_build(struct aggregate_report *r, uint32_t now)
+{
+	uint16_t addr = mesh_get_addr();
+	int i;
+
+	memset(r, 0, sizeof(*r));
+
+	r->nodes = 1U;
+	r->temp_sum = self_node_data.temperature * 10;
+	r->temp_min = r->temp_sum;
+	r->temp_max = r->temp_sum;
+
+	for (i = 0; i < current_nodes; i++) {
+		struct node_data *n = &neighbor_nodes_data[i];
+
+		if (n->is_calibrated) {
+			report_add_edge(r, addr, n->address,
+					MIN(n->filtered_distance / 10U,
+					    UINT8_MAX));
+		}
+	}
+
+	for (i = 0; i < ARRAY_SIZE(children); i++) {
+		if (children[i].addr != BT_MESH_ADDR_UNASSIGNED &&
+		    now - children[i].last_rx <
+		    CHILD_TIMEOUT_PERIODS * AGGREGATE_PERIOD_MS) {
+			report_merge(r, &children[i].report);
+		}
+	}
+}
+
+static void period(struct k_work *work)
+{
+	uint32_t now = k_uptime_get_32();
+	uint8_t depth = own_depth(now);
+
+	k_delayed_work_submit(&period_work,
+			      K_MSEC(AGGREGATE_PERIOD_MS -
+				     AGGREGATE_JITTER_MS / 2 +
+				     sys_rand32_get() % AGGREGATE_JITTER_MS));
+
+	if (!mesh_is_configured() || depth == AGGREGATE_DEPTH_NONE) {
+		return;
+	}
+
+	mesh_send_beacon(is_sink ? mesh_get_addr() : parent.sink, depth,
+			 is_sink ? BT_MESH_ADDR_UNASSIGNED : parent.addr);
+
+	report_build(&report, now);
+
+	if (is_sink) {
+		memcpy(&view, &report, sizeof(view));
+		gateway_aggregate_update(&view);
+	} else {
+		mesh_send_report(parent.addr, &report);
+	}
+}
+
+void aggregate_sink_set(bool sink)
+{
+	is_sink = sink;
+	parent.addr = BT_MESH_ADDR_UNASSIGNED;
+	memset(&view, 0, sizeof(view));
+
+	printk("Aggregation sink %s\n", sink ? "on" : "off");
+}
+
+bool aggregate_is_sink(void)
+{
+	return is_sink;
+}
+
+const struct aggregate_report *aggregate_view(void)
+{
+	return &view;
+}
+
+void aggregate_print(void)
+{
+	uint32_t now = k_uptime_get_32();
+	int i;
+
+	if (!MESH_AGGREGATE) {
+		return;
+	}
+
+	if (!is_sink) {
+		printk("Aggregation depth %u parent 0x%04x\n", own_depth(now),
+		       parent_valid(now) ? parent.addr : 0);
+		return;
+	}
+
+	if (!view.nodes) {
+		printk("Aggregation sink, no reports yet\n");
+		return;
+	}
+
+	printk("Aggregation sink: %u nodes, temperature %d/%d/%d (min/avg/max, 0.01 C)\n",
+	       view.nodes, view.temp_min, view.temp_sum / view.nodes,
+	       view.temp_max);
+
+	for (i = 0; i < view.edge_count; i++) {
+		printk("  %04x-%04x %u dm\n", view.edges[i].a, view.edges[i].b,
+		       view.edges[i].distance);
+	}
+}
+
+int aggregate_init(void)
+{
+	k_delayed_work_init(&period_work, period);
+
+	if (MESH_AGGREGATE) {
+		k_delayed_work_submit(&period_work,
+				      K_MSEC(AGGREGATE_PERIOD_MS));
+	}
+
+	return 0;
+}
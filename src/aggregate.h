@@ -0,0 +1,39 @@
+/*
+ * In-network aggregation toward a sink. Nodes pick the neighbor closest to
+ * the sink as their parent, and once per period send it a single report
+ * merging their own readings with the latest reports of their children.
+ */
+
+#define AGGREGATE_EDGES_MAX	48
+#define AGGREGATE_DEPTH_NONE	0xff
+
+struct aggregate_edge {
+	uint16_t a;
+	uint16_t b;
+	/* Decimetres, saturated */
+	uint8_t distance;
+};
+
+struct aggregate_report {
+	/* Nodes in the subtree, including the sender */
+	uint8_t nodes;
+	/* Temperatures in 0.01 degrees */
+	int16_t temp_min;
+	int16_t temp_max;
+	int32_t temp_sum;
+	uint8_t edge_count;
+	struct aggregate_edge edges[AGGREGATE_EDGES_MAX];
+};
+
+void aggregate_beacon_recv(uint16_t addr, uint16_t sink, uint8_t depth,
+			   uint16_t parent, int8_t rssi);
+void aggregate_report_recv(uint16_t addr, const struct aggregate_report *r);
+
+void aggregate_sink_set(bool sink);
+bool aggregate_is_sink(void);
+
+/* Whole network as merged at the sink during the last period */
+const struct aggregate_report *aggregate_view(void);
+void aggregate_print(void);
+
+int aggregate_init(void);
@@ -0,0 +1,181 @@
+/*
+ * Deferred diagnostic log: call sites queue compact binary records, a low
+ * priority thread formats them to the console.
+ */
+
+#include <zephyr.h>
+#include <sys/printk.h>
+
+#include "app_log.h"
+#include "mesh_app.h"
+
+#define APP_LOG_QUEUE_LEN	32
+#define APP_LOG_STACK_SIZE	2048
+#define APP_LOG_PRIORITY	K_LOWEST_APPLICATION_THREAD_PRIO
+
+/* printk() and the calls down to print_node_status() */
+#define APP_LOG_STACK_MARGIN	1024
+
+/* print_node_status() formats the neighbor list and three readings */
+BUILD_ASSERT(APP_LOG_STACK_MARGIN + NEIGHBOR_DISTANCES_LENGTH + 3 * 8 <=
+	     APP_LOG_STACK_SIZE, "Node status doesn't fit the log thread stack");
+
+struct app_log_rec {
+	uint32_t ts;
+	uint8_t cat;
+	uint8_t level;
+	uint8_t evt;
+	/* Records of the same category dropped by the rate limit before it */
+	uint8_t suppressed;
+	uint16_t addr;
+	int32_t args[2];
+};
+
+K_MSGQ_DEFINE(app_log_queue, sizeof(struct app_log_rec), APP_LOG_QUEUE_LEN, 4);
+
+static const char *const cat_names[APP_LOG_CAT_COUNT] = {
+	[APP_LOG_CAT_CALIBRATION] = "cal",
+	[APP_LOG_CAT_HEARTBEAT_RX] = "rx",
+	[APP_LOG_CAT_HEARTBEAT_TX] = "tx",
+	[APP_LOG_CAT_SENSOR] = "sens",
+};
+
+static const char *const evt_formats[APP_LOG_EVT_COUNT] = {
+	[APP_LOG_EVT_SNAPSHOT] = "snapshot",
+	[APP_LOG_EVT_CALIBRATION_STEP] = "calibration step %d, calibrated %d",
+	[APP_LOG_EVT_CALIBRATED] = "calibrated, measured power %d/100",
+	[APP_LOG_EVT_NODE_UPDATE] = "rssi %d temperature %d/10",
+	[APP_LOG_EVT_NODE_UNKNOWN] = "heartbeat from unknown node, rssi %d",
+	[APP_LOG_EVT_HEARTBEAT_TX] = "heartbeat %d bytes, %d neighbors",
+};
+
+static enum app_log_level log_level = APP_LOG_LEVEL_INF;
+
+/* Minimum interval between two records of a category, in milliseconds */
+static uint32_t rate_limits[APP_LOG_CAT_COUNT] = {
+	[APP_LOG_CAT_CALIBRATION] = 0,
+	[APP_LOG_CAT_HEARTBEAT_RX] = 1000,
+	[APP_LOG_CAT_HEARTBEAT_TX] = 10000,
+	[APP_LOG_CAT_SENSOR] = 5000,
+};
+
+static uint32_t last_ts[APP_LOG_CAT_COUNT];
+static uint32_t suppressed[APP_LOG_CAT_COUNT];
+static atomic_t dropped;
+static atomic_t dropped_total;
+static uint8_t high_water;
+
+static void queue_put(const struct app_log_rec *rec)
+{
+	if (k_msgq_put(&app_log_queue, rec, K_NO_WAIT)) {
+		atomic_inc(&dropped);
+		atomic_inc(&dropped_total);
+		return;
+	}
+
+	high_water = MAX(high_water, k_msgq_num_used_get(&app_log_queue));
+}
+
+void app_log(enum app_log_cat cat, enum app_log_level level,
+	     enum app_log_evt evt, uint16_t addr, int32_t arg0, int32_t arg1)
+{
+	struct app_log_rec rec;
+	uint32_t now;
+
+	if (level > log_level) {
+		return;
+	}
+
+	now = k_uptime_get_32();
+
+	if (last_ts[cat] && now - last_ts[cat] < rate_limits[cat]) {
+		suppressed[cat]++;
+		return;
+	}
+
+	last_ts[cat] = now;
+
+	rec.ts = now;
+	rec.cat = cat;
+	rec.level = level;
+	rec.evt = evt;
+	rec.suppressed = MIN(suppressed[cat], UINT8_MAX);
+	rec.addr = addr;
+	rec.args[0] = arg0;
+	rec.args[1] = arg1;
+
+	suppressed[cat] = 0U;
+
+	queue_put(&rec);
+}
+
+void app_log_level_set(enum app_log_level level)
+{
+	log_level = level;
+}
+
+enum app_log_level app_log_level_get(void)
+{
+	return log_level;
+}
+
+void app_log_rate_set(enum app_log_cat cat, uint32_t interval_ms)
+{
+	if (cat < APP_LOG_CAT_COUNT) {
+		rate_limits[cat] = interval_ms;
+	}
+}
+
+void app_log_snapshot_request(void)
+{
+	struct app_log_rec rec = {
+		.ts = k_uptime_get_32(),
+		.evt = APP_LOG_EVT_SNAPSHOT,
+	};
+
+	queue_put(&rec);
+}
+
+void app_log_queue_stats(uint8_t *max_used, uint32_t *lost)
+{
+	*max_used = high_water;
+	*lost = atomic_get(&dropped_total);
+}
+
+static void app_log_print(const struct app_log_rec *rec)
+{
+	printk("[%u.%03u] %s 0x%04x: ", rec->ts / MSEC_PER_SEC,
+	       rec->ts % MSEC_PER_SEC, cat_names[rec->cat], rec->addr);
+	printk(evt_formats[rec->evt], rec->args[0], rec->args[1]);
+
+	if (rec->suppressed) {
+		printk(" (+%u suppressed)", rec->suppressed);
+	}
+
+	printk("\n");
+}
+
+static void app_log_thread(void *p1, void *p2, void *p3)
+{
+	struct app_log_rec rec;
+	atomic_val_t lost;
+
+	while (1) {
+		k_msgq_get(&app_log_queue, &rec, K_FOREVER);
+
+		lost = atomic_set(&dropped, 0);
+		if (lost) {
+			printk("app_log: %d records dropped\n", lost);
+		}
+
+		if (rec.evt == APP_LOG_EVT_SNAPSHOT) {
+			print_status_update();
+			continue;
+		}
+
+		app_log_print(&rec);
+	}
+}
+
+K_THREAD_DEFINE(app_log_tid, APP_LOG_STACK_SIZE, app_log_thread,
+		NULL, NULL, NULL, APP_LOG_PRIORITY, 0, 0);
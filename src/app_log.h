@@ -0,0 +1,43 @@
+/*
+ * Deferred diagnostic log: call sites queue compact binary records, a low
+ * priority thread formats them to the console.
+ */
+
+enum app_log_level {
+	APP_LOG_LEVEL_NONE = 0,
+	APP_LOG_LEVEL_ERR,
+	APP_LOG_LEVEL_WRN,
+	APP_LOG_LEVEL_INF,
+	APP_LOG_LEVEL_DBG,
+};
+
+enum app_log_cat {
+	APP_LOG_CAT_CALIBRATION = 0,
+	APP_LOG_CAT_HEARTBEAT_RX,
+	APP_LOG_CAT_HEARTBEAT_TX,
+	APP_LOG_CAT_SENSOR,
+	APP_LOG_CAT_COUNT,
+};
+
+enum app_log_evt {
+	APP_LOG_EVT_SNAPSHOT = 0,
+	APP_LOG_EVT_CALIBRATION_STEP,
+	APP_LOG_EVT_CALIBRATED,
+	APP_LOG_EVT_NODE_UPDATE,
+	APP_LOG_EVT_NODE_UNKNOWN,
+	APP_LOG_EVT_HEARTBEAT_TX,
+	APP_LOG_EVT_COUNT,
+};
+
+void app_log(enum app_log_cat cat, enum app_log_level level,
+	     enum app_log_evt evt, uint16_t addr, int32_t arg0, int32_t arg1);
+
+void app_log_level_set(enum app_log_level level);
+enum app_log_level app_log_level_get(void);
+void app_log_rate_set(enum app_log_cat cat, uint32_t interval_ms);
+
+/* Print the full node table and mesh summary from the log thread */
+void app_log_snapshot_request(void);
+
+/* Most records ever queued at once, and records lost to a full queue */
+void app_log_queue_stats(uint8_t *max_used, uint32_t *lost);
@@ -0,0 +1,178 @@
+/*
+ * Benchmark of the message path. The neighbor table is filled with synthetic
+ * calibrated nodes, then every function is timed with the cycle counter for a
+ * growing number of nodes, past MAX_NODES to time the full table as well.
+ *
+ * It runs on the host, see tests/bench, or on the board before Bluetooth is
+ * enabled, so nothing else competes for the CPU. The output is CSV, one line
+ * per function and node count:
+ *
+ *   bench,function,nodes,stored,iterations,ns_per_op,allocs_per_op,
+ *   resolution_ns
+ *
+ * The resolution is one tick of the cycle counter, the RTC on nRF boards
+ * (30517 ns) and 1 ns on the host. A loop is timed to one tick, so ns_per_op
+ * is good to about resolution_ns / BENCH_ITERATIONS.
+ */
+
+#include <zephyr.h>
+#include <string.h>
+#include <sys/printk.h>
+
+#include <drivers/sensor.h>
+
+#include "mesh.h"
+#include "mesh_app.h"
+#include "board.h"
+#include "bench.h"
+
+#define BENCH_ITERATIONS	200
+#define BENCH_ADDR_BASE		0x0100
+
+/* Proximity accepted as a calibration step, see is_valid_calibration() */
+#define BENCH_PROXIMITY		250
+#define BENCH_RSSI		-60
+
+static const int node_counts[] = { 1, 2, 4, MAX_NODES / 2, MAX_NODES,
+				   2 * MAX_NODES };
+
+static char message[MAX_MESSAGE_SIZE];
+static char summary[(MAX_NODES + 1) * (MAX_MESSAGE_SIZE + 1)];
+
+struct bench_result {
+	uint32_t cycles;
+	uint32_t allocs;
+};
+
+static void result_print(const char *name, int nodes,
+			 const struct bench_result *res)
+{
+	uint32_t ns = k_cyc_to_ns_floor64(res->cycles) / BENCH_ITERATIONS;
+	uint32_t allocs = res->allocs * 100U / BENCH_ITERATIONS;
+
+	printk("bench,%s,%d,%d,%u,%u,%u.%02u,%u\n", name, nodes, current_nodes,
+	       BENCH_ITERATIONS, ns, allocs / 100U, allocs % 100U,
+	       (uint32_t)k_cyc_to_ns_ceil64(1));
+}
+
+static void result_start(struct bench_result *res)
+{
+	res->allocs = mesh_app_allocs;
+	res->cycles = k_cycle_get_32();
+}
+
+static void result_end(struct bench_result *res)
+{
+	res->cycles = k_cycle_get_32() - res->cycles;
+	res->allocs = mesh_app_allocs - res->allocs;
+}
+
+static void table_fill(int nodes)
+{
+	char name[NAME_SIZE];
+	int i, step;
+
+	initialize_app();
+	current_nodes = 0;
+
+	for (i = 0; i < nodes; i++) {
+		snprintk(name, sizeof(name), "n%d", i);
+
+		for (step = 0; step < CALIBRATION_STEPS; step++) {
+			calibrate_node(BENCH_ADDR_BASE + i, name,
+				       BENCH_PROXIMITY, BENCH_RSSI);
+		}
+	}
+
+	/* Every neighbor reports a full table of its own */
+	get_self_node_message(message);
+
+	for (i = 0; i < current_nodes; i++) {
+		update_node_data(BENCH_ADDR_BASE + i, BENCH_RSSI - i, message);
+	}
+}
+
+static void bench_nodes(int nodes)
+{
+	struct bench_result res;
+	int i;
+
+	table_fill(nodes);
+
+	if (current_nodes == 0) {
+		return;
+	}
+
+	result_start(&res);
+	for (i = 0; i < BENCH_ITERATIONS; i++) {
+		get_self_node_message(message);
+	}
+	result_end(&res);
+	result_print("get_self_node_message", nodes, &res);
+
+	result_start(&res);
+	for (i = 0; i < BENCH_ITERATIONS; i++) {
+		update_node_data(BENCH_ADDR_BASE + i % current_nodes,
+				 BENCH_RSSI - i % 10, message);
+	}
+	result_end(&res);
+	result_print("update_node_data", nodes, &res);
+
+	result_start(&res);
+	for (i = 0; i < BENCH_ITERATIONS; i++) {
+		summary[0] = '\0';
+		get_mesh_summary(summary);
+	}
+	result_end(&res);
+	result_print("get_mesh_summary", nodes, &res);
+
+	/* The last step of a calibration, which computes the distance factor */
+	result_start(&res);
+	for (i = 0; i < BENCH_ITERATIONS; i++) {
+		struct node_data *n = &neighbor_nodes_data[i % current_nodes];
+
+		n->calibration_step = CALIBRATION_STEPS - 1;
+		calibrate_node(n->address, n->name, BENCH_PROXIMITY,
+			       BENCH_RSSI);
+	}
+	result_end(&res);
+	result_print("calibrate_node", nodes, &res);
+
+	result_start(&res);
+	for (i = 0; i < BENCH_ITERATIONS; i++) {
+		update_average_temperature();
+	}
+	result_end(&res);
+	result_print("update_average_temperature", nodes, &res);
+}
+
+void bench_run(void)
+{
+	int i, j, nodes;
+
+	/* Keep the e-paper out of the measurements */
+	board_set_display_interval(0);
+
+	printk("bench,function,nodes,stored,iterations,ns_per_op,allocs_per_op,"
+	       "resolution_ns\n");
+
+	/* With a small MAX_NODES some counts are zero or repeat an earlier one */
+	for (i = 0; i < ARRAY_SIZE(node_counts); i++) {
+		nodes = MAX(node_counts[i], 1);
+
+		for (j = 0; j < i; j++) {
+			if (MAX(node_counts[j], 1) == nodes) {
+				break;
+			}
+		}
+
+		if (j == i) {
+			bench_nodes(nodes);
+		}
+	}
+
+	printk("bench,done\n");
+
+	initialize_app();
+	current_nodes = 0;
+}
@@ -0,0 +1,6 @@
+/*
+ * Benchmark of the message path, built in with MESH_BENCH or on the host with
+ * tests/bench. Results go to the console as CSV lines starting with "bench,".
+ */
+
+void bench_run(void);
@@ -13,11 +13,30 @@ enum periph_device {
 	DEV_IDX_NUMOF,
 };
 
+/* Models rendered on the screens, bumped whenever their content changes */
+enum board_model {
+	BOARD_MODEL_NODES = 0,
+	BOARD_MODEL_AVERAGE,
+	BOARD_MODEL_SENSORS,
+	BOARD_MODEL_STATS,
+	BOARD_MODEL_ENERGY,
+	BOARD_MODEL_COUNT,
+};
+
 void board_refresh_display(void);
+void board_model_changed(enum board_model model);
 void board_show_text(const char *text, bool center, k_timeout_t duration);
 void board_blink_leds(void);
 void board_add_hello(uint16_t addr, const char *name);
-void board_add_heartbeat(uint16_t addr, uint8_t hops);
+void board_add_heartbeat(uint16_t addr, uint8_t hops, uint16_t seq,
+			 int8_t rssi, uint8_t period);
+void board_reject_heartbeat(uint16_t addr, bool stale);
+void board_print_link_stats(void);
+/* Heartbeats received and sent according to the sequence numbers, all links */
+void board_link_totals(uint32_t *received, uint32_t *expected);
+/* Heartbeats dropped by the sequence windows, all links */
+void board_link_rejects(uint32_t *duplicates, uint32_t *stale);
+uint32_t board_sender_count(void);
 int get_hdc1010_val(struct sensor_value *val);
 int get_mma8652_val(struct sensor_value *val);
 int get_apds9960_val(struct sensor_value *val);
@@ -25,3 +44,6 @@ int set_led_state(uint8_t id, bool state);
 int periphs_init(void);
 int board_init(void);
 void start_sensor_values_work(void);
+void board_set_sensor_interval(uint32_t interval_ms);
+void board_set_display_interval(uint32_t interval_ms);
+int get_battery_mv(void);
@@ -0,0 +1,324 @@
+/*
+ * Self-commissioning: a board derives a candidate unicast address from its
+ * identity address and probes the group for it before taking it. Probes are
+ * sent from a random temporary address, so that the replay protection of the
+ * owner of the candidate doesn't drop them. Provisioned boards act as
+ * witnesses and report probes that claim an address already owned by another
+ * identity.
+ *
+ * A board that has committed its address always keeps it: a probe for it
+ * gets a conflict back from the owner itself. Witnesses keep the first
+ * identity they saw claiming an address. Two boards still probing the same
+ * candidate resolve the same way on both sides, the lower identity keeps
+ * probing and the other one derives its next candidate.
+ */
+
+#include <zephyr.h>
+#include <string.h>
+#include <sys/printk.h>
+#include <sys/crc.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/mesh.h>
+#include <drivers/sensor.h>
+
+#include "mesh.h"
+#include "board.h"
+#include "commission.h"
+#include "friendship.h"
+
+#define PROBE_COUNT			3
+#define PROBE_DELAY_MIN_MS		500
+#define PROBE_DELAY_RANDOM_MS		1000
+#define CONFLICT_DELAY_RANDOM_MS	500
+#define ATTEMPTS_MAX			16
+#define OWNER_COUNT			CONFIG_APP_COMMISSION_OWNERS
+
+enum commission_state {
+	COMMISSION_IDLE,
+	COMMISSION_PROBING,
+	COMMISSION_DONE,
+};
+
+struct addr_owner {
+	uint16_t addr;
+	uint8_t id[COMMISSION_ID_SIZE];
+};
+
+static enum commission_state state;
+static uint8_t identity[COMMISSION_ID_SIZE];
+static uint16_t candidate;
+static uint8_t attempt;
+static uint8_t probes_sent;
+
+static struct k_delayed_work probe_work;
+static struct k_delayed_work conflict_work;
+static struct k_work restart_work;
+
+/* Identities seen claiming an address, the oldest entry is replaced first */
+static struct addr_owner owners[OWNER_COUNT];
+static uint16_t owner_next;
+
+/*
+ * Conflict waiting for its random delay, so that only one of the witnesses
+ * reports it. Dropped when another witness reports the address first.
+ */
+static struct addr_owner pending_conflict;
+
+static uint16_t random_delay(uint16_t range)
+{
+	uint16_t r;
+
+	if (bt_rand(&r, sizeof(r))) {
+		return range / 2U;
+	}
+
+	return r % range;
+}
+
+static uint16_t unicast_addr(uint16_t addr)
+{
+	/* Make sure it's a unicast address (highest bit unset) */
+	addr &= ~0x8000;
+
+	return addr ? addr : 1U;
+}
+
+static void schedule_probe(void)
+{
+	k_delayed_work_submit(&probe_work,
+			      K_MSEC(PROBE_DELAY_MIN_MS +
+				     random_delay(PROBE_DELAY_RANDOM_MS)));
+}
+
+void commission_start(void)
+{
+	bt_addr_le_t addrs[CONFIG_BT_ID_MAX];
+	size_t count = ARRAY_SIZE(addrs);
+	uint16_t temp_addr;
+	int err;
+
+	bt_id_get(addrs, &count);
+	memcpy(identity, addrs[BT_ID_DEFAULT].a.val, sizeof(identity));
+
+	if (mesh_is_initialized() && mesh_is_configured()) {
+		candidate = mesh_get_addr();
+		state = COMMISSION_DONE;
+		friendship_start();
+		return;
+	}
+
+	if (mesh_is_initialized()) {
+		/* Restarted while probing, start over from a new address */
+		mesh_unprovision();
+	}
+
+	candidate = unicast_addr(crc16_ccitt(attempt, identity,
+					     sizeof(identity)));
+
+	err = bt_rand(&temp_addr, sizeof(temp_addr));
+	if (!err) {
+		err = mesh_provision(unicast_addr(temp_addr));
+	}
+
+	if (err) {
+		printk("Provisioning failed (err %d)\n", err);
+		board_show_text("Starting Mesh Failed", false, K_SECONDS(2));
+		return;
+	}
+
+	printk("Probing address 0x%04x (attempt %u)\n", candidate, attempt);
+
+	state = COMMISSION_PROBING;
+	probes_sent = 0U;
+	schedule_probe();
+}
+
+bool commission_is_done(void)
+{
+	return state == COMMISSION_DONE;
+}
+
+static void probe(struct k_work *work)
+{
+	char buf[32];
+
+	if (state != COMMISSION_PROBING) {
+		return;
+	}
+
+	if (probes_sent < PROBE_COUNT) {
+		mesh_send_probe(candidate, identity);
+		probes_sent++;
+		schedule_probe();
+		return;
+	}
+
+	/* Nobody objected, the address is ours */
+	mesh_unprovision();
+
+	if (mesh_provision(candidate)) {
+		k_work_submit(&restart_work);
+		return;
+	}
+
+	mesh_configure_publication();
+	state = COMMISSION_DONE;
+	attempt = 0U;
+
+	/* Let the witnesses know who owns it now */
+	mesh_send_probe(candidate, identity);
+
+	friendship_start();
+
+	/* Give the board a name of its own if nobody set one over GATT */
+	if (!strcmp(bt_get_name(), CONFIG_BT_DEVICE_NAME)) {
+		snprintk(buf, sizeof(buf), "b-%04x", mesh_get_addr());
+		bt_set_name(buf);
+	}
+
+	snprintk(buf, sizeof(buf), "Mesh Started\nAddr: 0x%04x",
+		 mesh_get_addr());
+	board_show_text(buf, false, K_SECONDS(4));
+}
+
+static void restart(struct k_work *work)
+{
+	k_delayed_work_cancel(&probe_work);
+	mesh_unprovision();
+	state = COMMISSION_IDLE;
+
+	if (++attempt >= ATTEMPTS_MAX) {
+		printk("No free address after %u attempts\n", attempt);
+		board_show_text("Address conflict", false, K_FOREVER);
+		return;
+	}
+
+	commission_start();
+}
+
+static void lose_address(void)
+{
+	printk("Address 0x%04x is taken, picking another one\n", candidate);
+
+	state = COMMISSION_IDLE;
+	k_work_submit(&restart_work);
+}
+
+static void add_owner(uint16_t addr, const uint8_t *id)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(owners); i++) {
+		if (owners[i].addr == addr) {
+			memcpy(owners[i].id, id, COMMISSION_ID_SIZE);
+			return;
+		}
+	}
+
+	owners[owner_next].addr = addr;
+	memcpy(owners[owner_next].id, id, COMMISSION_ID_SIZE);
+	owner_next = (owner_next + 1) % ARRAY_SIZE(owners);
+}
+
+static struct addr_owner *find_owner(uint16_t addr)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(owners); i++) {
+		if (owners[i].addr == addr) {
+			return &owners[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void report_conflict(uint16_t addr, const uint8_t *winner_id)
+{
+	pending_conflict.addr = addr;
+	memcpy(pending_conflict.id, winner_id, COMMISSION_ID_SIZE);
+
+	k_delayed_work_submit(&conflict_work,
+			      K_MSEC(random_delay(CONFLICT_DELAY_RANDOM_MS)));
+}
+
+static void send_conflict(struct k_work *work)
+{
+	if (pending_conflict.addr == BT_MESH_ADDR_UNASSIGNED) {
+		return;
+	}
+
+	mesh_send_conflict(pending_conflict.addr, pending_conflict.id);
+	pending_conflict.addr = BT_MESH_ADDR_UNASSIGNED;
+}
+
+void commission_probe_recv(uint16_t addr, const uint8_t *id)
+{
+	struct addr_owner *owner;
+
+	if (state == COMMISSION_IDLE) {
+		return;
+	}
+
+	if (addr == candidate) {
+		if (!memcmp(id, identity, sizeof(identity))) {
+			return;
+		}
+
+		/* A committed address is never given up */
+		if (state == COMMISSION_DONE ||
+		    memcmp(identity, id, sizeof(identity)) < 0) {
+			report_conflict(addr, identity);
+		} else {
+			lose_address();
+		}
+
+		return;
+	}
+
+	owner = find_owner(addr);
+	if (!owner) {
+		add_owner(addr, id);
+		return;
+	}
+
+	/* The first owner stays, whatever the identity of the newcomer */
+	if (memcmp(owner->id, id, COMMISSION_ID_SIZE)) {
+		report_conflict(addr, owner->id);
+	}
+}
+
+void commission_conflict_recv(uint16_t addr, const uint8_t *winner_id)
+{
+	if (pending_conflict.addr == addr) {
+		/* Another witness reported it already */
+		k_delayed_work_cancel(&conflict_work);
+		pending_conflict.addr = BT_MESH_ADDR_UNASSIGNED;
+	}
+
+	if (!find_owner(addr)) {
+		add_owner(addr, winner_id);
+	}
+
+	if (state == COMMISSION_IDLE || addr != candidate ||
+	    !memcmp(winner_id, identity, sizeof(identity))) {
+		return;
+	}
+
+	if (state == COMMISSION_DONE) {
+		/* Stale witness, tell everyone who owns it */
+		report_conflict(addr, identity);
+	} else {
+		lose_address();
+	}
+}
+
+int commission_init(void)
+{
+	k_delayed_work_init(&probe_work, probe);
+	k_delayed_work_init(&conflict_work, send_conflict);
+	k_work_init(&restart_work, restart);
+
+	return 0;
+}
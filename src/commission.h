@@ -0,0 +1,16 @@
+/*
+ * Self-commissioning: a board derives a candidate unicast address from its
+ * identity address and probes the group for it before taking it.
+ * Provisioned boards act as witnesses and report probes that claim an
+ * address already owned by another identity.
+ */
+
+#define COMMISSION_ID_SIZE 6
+
+void commission_start(void);
+bool commission_is_done(void);
+
+void commission_probe_recv(uint16_t addr, const uint8_t *id);
+void commission_conflict_recv(uint16_t addr, const uint8_t *winner_id);
+
+int commission_init(void);
@@ -0,0 +1,312 @@
+/*
+ * Remote diagnostics. The pages are built on request from the live state,
+ * so a dump taken over several round trips may mix a few seconds of
+ * updates. Only one node is polled at a time, the next page is requested
+ * when the previous one arrives and a page that doesn't is asked again a
+ * couple of times before the poll gives up.
+ */
+
+#include <zephyr.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/printk.h>
+#include <sys/byteorder.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/mesh.h>
+#include <drivers/sensor.h>
+
+#include "mesh.h"
+#include "board.h"
+#include "mesh_app.h"
+#include "app_log.h"
+#include "ttl_ctl.h"
+#include "power.h"
+#include "energy.h"
+#include "gateway.h"
+#include "diag.h"
+
+#define DIAG_TIMEOUT		K_SECONDS(2)
+#define DIAG_RETRIES		2
+
+/* The gateway polls one node per interval, itself included */
+#define DIAG_FLEET_INTERVAL	K_SECONDS(30)
+
+#define DIAG_CALIBRATED		0x80
+
+static struct diag_dump dump;
+static uint8_t next_page;
+static uint8_t retries;
+static bool polling;
+static uint8_t fleet_next;
+
+static struct k_delayed_work timeout_work;
+static struct k_delayed_work fleet_work;
+
+static uint16_t sat16(uint32_t val)
+{
+	return MIN(val, UINT16_MAX);
+}
+
+static uint8_t sat8(uint32_t val)
+{
+	return MIN(val, UINT8_MAX);
+}
+
+static void page_summary(uint8_t *data)
+{
+	int calibrated = 0;
+	int i;
+
+	for (i = 0; i < current_nodes; i++) {
+		calibrated += neighbor_nodes_data[i].is_calibrated ? 1 : 0;
+	}
+
+	data[0] = DIAG_PAGES_FIXED + current_nodes;
+	data[1] = current_nodes;
+	data[2] = sat8(board_sender_count());
+	data[3] = power_level_get();
+	data[4] = calibrated;
+	sys_put_le16(sat16(k_uptime_get_32() / (60U * MSEC_PER_SEC)),
+		     &data[5]);
+}
+
+static void page_links(uint8_t *data)
+{
+	uint32_t received, expected, duplicates, stale;
+
+	board_link_totals(&received, &expected);
+	board_link_rejects(&duplicates, &stale);
+
+	sys_put_le16(sat16(received), &data[0]);
+	sys_put_le16(sat16(expected), &data[2]);
+	sys_put_le16(sat16(duplicates), &data[4]);
+	data[6] = sat8(stale);
+}
+
+static void page_traffic(uint8_t *data)
+{
+	static struct energy_report r;
+
+	energy_report(&r);
+
+	sys_put_le16(sat16(r.events[ENERGY_TX_UNSEG].count +
+			   r.events[ENERGY_TX_SEG].count), &data[0]);
+	sys_put_le16(sat16(r.events[ENERGY_RELAY].count), &data[2]);
+	sys_put_le16(sat16(mesh_app_allocs), &data[4]);
+	data[6] = ttl_ctl_get();
+}
+
+static void page_queues(uint8_t *data)
+{
+	struct gateway_queue_stats gw;
+	uint8_t log_max;
+	uint32_t log_lost;
+
+	app_log_queue_stats(&log_max, &log_lost);
+	gateway_queue_stats(&gw);
+
+	data[0] = log_max;
+	sys_put_le16(sat16(log_lost), &data[1]);
+	data[3] = gw.uplink_high_water;
+	sys_put_le16(sat16(gw.uplink_dropped), &data[4]);
+	data[6] = sat8(ceiling_fraction(gw.tx_high_water, 8U));
+}
+
+static void page_neighbor(int rank, uint8_t *data)
+{
+	struct node_data *n = get_sorted_neighbor(rank);
+
+	sys_put_le16(n->address, &data[0]);
+	data[2] = (int8_t)n->rssi;
+	data[3] = sat8(n->filtered_distance / 10U);
+	data[4] = MIN(n->calibration_step, CALIBRATION_STEPS) |
+		  (n->is_calibrated ? DIAG_CALIBRATED : 0);
+	sys_put_le16(n->temperature * 10, &data[5]);
+}
+
+uint8_t diag_page(uint8_t page, uint8_t data[DIAG_PAGE_SIZE])
+{
+	memset(data, 0, DIAG_PAGE_SIZE);
+
+	switch (page) {
+	case 0:
+		page_summary(data);
+		break;
+	case 1:
+		page_links(data);
+		break;
+	case 2:
+		page_traffic(data);
+		break;
+	case 3:
+		page_queues(data);
+		break;
+	default:
+		if (page - DIAG_PAGES_FIXED >= current_nodes) {
+			return 0;
+		}
+
+		page_neighbor(page - DIAG_PAGES_FIXED, data);
+		break;
+	}
+
+	return DIAG_PAGE_SIZE;
+}
+
+static void request(void)
+{
+	mesh_send_stats_get(dump.addr, next_page);
+	k_delayed_work_submit(&timeout_work, DIAG_TIMEOUT);
+}
+
+int diag_poll(uint16_t addr)
+{
+	if (polling) {
+		return -EBUSY;
+	}
+
+	memset(&dump, 0, sizeof(dump));
+	dump.addr = addr;
+	next_page = 0U;
+	retries = 0U;
+	polling = true;
+
+	request();
+
+	return 0;
+}
+
+static void poll_done(void)
+{
+	polling = false;
+
+	diag_print(&dump);
+	gateway_health_update(&dump);
+}
+
+void diag_status_recv(uint16_t addr, uint8_t page, const uint8_t *data,
+		      uint8_t len)
+{
+	/* Pages are always sent whole, a short one is left to the retry */
+	if (!polling || addr != dump.addr || page != next_page ||
+	    len < DIAG_PAGE_SIZE) {
+		return;
+	}
+
+	k_delayed_work_cancel(&timeout_work);
+
+	memcpy(dump.pages[page], data, DIAG_PAGE_SIZE);
+
+	if (page == 0U) {
+		dump.page_count = MIN(data[0], DIAG_PAGES_MAX);
+	}
+
+	retries = 0U;
+
+	if (++next_page < dump.page_count) {
+		request();
+	} else {
+		poll_done();
+	}
+}
+
+static void timeout(struct k_work *work)
+{
+	if (!polling) {
+		return;
+	}
+
+	if (retries++ < DIAG_RETRIES) {
+		request();
+		return;
+	}
+
+	printk("Stats of 0x%04x: no answer for page %u\n", dump.addr,
+	       next_page);
+	polling = false;
+}
+
+static void fleet(struct k_work *work)
+{
+	static struct diag_dump self;
+	uint8_t i;
+
+	k_delayed_work_submit(&fleet_work, DIAG_FLEET_INTERVAL);
+
+	if (!gateway_is_enabled() || !mesh_is_configured() || polling) {
+		return;
+	}
+
+	if (fleet_next < current_nodes) {
+		diag_poll(neighbor_nodes_data[fleet_next++].address);
+		return;
+	}
+
+	/* The gateway reports itself without going over the air */
+	fleet_next = 0U;
+
+	self.addr = mesh_get_addr();
+	self.page_count = DIAG_PAGES_FIXED + current_nodes;
+
+	for (i = 0U; i < self.page_count; i++) {
+		diag_page(i, self.pages[i]);
+	}
+
+	gateway_health_update(&self);
+}
+
+void diag_print(const struct diag_dump *d)
+{
+	const uint8_t *p;
+	int i;
+
+	if (d->page_count < DIAG_PAGES_FIXED) {
+		printk("Stats of 0x%04x: %u pages\n", d->addr, d->page_count);
+		return;
+	}
+
+	p = d->pages[0];
+	printk("Stats of 0x%04x: up %u min, level %u, %u neighbors "
+	       "(%u calibrated), %u senders\n", d->addr, sys_get_le16(&p[5]),
+	       p[3], p[1], p[4], p[2]);
+
+	p = d->pages[1];
+	printk("  heartbeats %u of %u, %u duplicates, %u stale\n",
+	       sys_get_le16(&p[0]), sys_get_le16(&p[2]), sys_get_le16(&p[4]),
+	       p[6]);
+
+	p = d->pages[2];
+	printk("  sent %u, relayed %u, allocs %u, ttl %u\n",
+	       sys_get_le16(&p[0]), sys_get_le16(&p[2]), sys_get_le16(&p[4]),
+	       p[6]);
+
+	p = d->pages[3];
+	printk("  log queue max %u lost %u, uplink max %u dropped %u, "
+	       "uart max %u\n", p[0], sys_get_le16(&p[1]), p[3],
+	       sys_get_le16(&p[4]), p[6] * 8U);
+
+	for (i = DIAG_PAGES_FIXED; i < d->page_count; i++) {
+		int16_t temp;
+
+		p = d->pages[i];
+		temp = sys_get_le16(&p[5]);
+
+		printk("  0x%04x rssi %d dist %u.%u m cal %u%s "
+		       "temp %s%d.%02d C\n",
+		       sys_get_le16(&p[0]), (int8_t)p[2], p[3] / 10U,
+		       p[3] % 10U, p[4] & ~DIAG_CALIBRATED,
+		       (p[4] & DIAG_CALIBRATED) ? " done" : "",
+		       temp < 0 ? "-" : "", abs(temp) / 100, abs(temp) % 100);
+	}
+}
+
+int diag_init(void)
+{
+	k_delayed_work_init(&timeout_work, timeout);
+	k_delayed_work_init(&fleet_work, fleet);
+	k_delayed_work_submit(&fleet_work, DIAG_FLEET_INTERVAL);
+
+	return 0;
+}
@@ -0,0 +1,41 @@
+/*
+ * Remote diagnostics: a node answers a stats get with one page of its
+ * internals, small enough for an unsegmented message. A poller walks the
+ * pages of a node one after the other and prints the dump; the gateway
+ * polls every known node in turn and streams the dumps to the host.
+ *
+ * Pages, all fields little endian:
+ *   0  page count (u8), neighbors (u8), senders heard (u8), power level (u8),
+ *      calibrated neighbors (u8), uptime (u16, minutes)
+ *   1  heartbeats received, expected, duplicates (u16), stale (u8)
+ *   2  messages sent, relayed, heap allocations (u16), TTL (u8)
+ *   3  log queue high-water mark (u8), log records dropped (u16),
+ *      uplink queue high-water mark (u8), uplink records dropped (u16),
+ *      gateway buffer high-water mark (u8, 8 octet units)
+ *   4+ one neighbor each, closest first: addr (u16), rssi (s8),
+ *      distance (u8, dm), calibration step (u8, bit 7 once calibrated),
+ *      temperature (s16, 0.01 C)
+ *
+ * Counters saturate instead of wrapping.
+ */
+
+#define DIAG_PAGE_SIZE		7
+#define DIAG_PAGES_FIXED	4
+#define DIAG_PAGES_MAX		(DIAG_PAGES_FIXED + MAX_NODES)
+
+struct diag_dump {
+	uint16_t addr;
+	uint8_t page_count;
+	uint8_t pages[DIAG_PAGES_MAX][DIAG_PAGE_SIZE];
+};
+
+/* Fill a page of this node, 0 past the last one */
+uint8_t diag_page(uint8_t page, uint8_t data[DIAG_PAGE_SIZE]);
+
+/* Fetch every page of a node, printed once complete */
+int diag_poll(uint16_t addr);
+void diag_status_recv(uint16_t addr, uint8_t page, const uint8_t *data,
+		      uint8_t len);
+
+void diag_print(const struct diag_dump *dump);
+int diag_init(void);
@@ -0,0 +1,190 @@
+/*
+ * Energy accounting. Every costly event is counted with a time stamp, and
+ * the estimate charges each one with a fixed amount taken from the data
+ * sheets, plus the time spent in the timed app work (heartbeat publication,
+ * sensor fetches, redraws and the gateway drain, not the work items of the
+ * stack), the time the radio spends receiving and the sleep current for the
+ * rest.
+ *
+ * The figures are meant to compare settings against each other, not to
+ * predict the battery life to the day.
+ */
+
+#include <zephyr.h>
+#include <string.h>
+#include <sys/printk.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/mesh.h>
+#include <drivers/sensor.h>
+
+#include "board.h"
+#include "friendship.h"
+#include "energy.h"
+
+/* Unsegmented access PDUs up to this size, TransMIC included */
+#define UNSEG_PDU_MAX		15
+#define SEG_PDU_SIZE		12
+#define TRANS_MIC_SIZE		4
+
+/* Charge per event and per octet sent, in nC (nA over a second) */
+#define TX_BYTE_NC		460
+/* nRF52840 at 64 MHz, per us of timed app work */
+#define CPU_ACTIVE_NC_PER_US	4
+/* Per ms of scanning, and per ms asleep */
+#define RADIO_RX_NC_PER_MS	6000
+#define SLEEP_NC_PER_MS		5
+
+#define NC_PER_UAH		3600000ULL
+
+#define ENERGY_UPDATE_INTERVAL	K_MINUTES(1)
+
+static const struct {
+	const char *name;
+	uint32_t charge_nc;
+} events[ENERGY_EVENT_COUNT] = {
+	/* Three network transmissions on three advertising channels */
+	[ENERGY_TX_UNSEG] = { "tx", 30000 },
+	[ENERGY_TX_SEG] = { "tx seg", 30000 },
+	[ENERGY_RELAY] = { "relay", 30000 },
+	/* Two conversions of about 7 ms each */
+	[ENERGY_FETCH_HDC1010] = { "hdc1010", 3000 },
+	[ENERGY_FETCH_MMA8652] = { "mma8652", 200 },
+	/* The light integration time dominates */
+	[ENERGY_FETCH_APDS9960] = { "apds9960", 20000 },
+	/* About 2 s and 0.4 s of waveform at 3 mA */
+	[ENERGY_EPD_FULL] = { "epd full", 6000000 },
+	[ENERGY_EPD_PARTIAL] = { "epd partial", 1200000 },
+};
+
+static struct k_spinlock lock;
+static struct energy_counter counters[ENERGY_EVENT_COUNT];
+static uint64_t work_us;
+
+static struct k_delayed_work update_work;
+
+static void count(enum energy_event event, uint32_t n, uint32_t bytes)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+
+	counters[event].count += n;
+	counters[event].bytes += bytes;
+	counters[event].last = k_uptime_get_32();
+
+	k_spin_unlock(&lock, key);
+}
+
+void energy_count(enum energy_event event)
+{
+	count(event, 1U, 0U);
+}
+
+void energy_tx(uint16_t len)
+{
+	uint16_t pdu = len + TRANS_MIC_SIZE;
+
+	if (pdu <= UNSEG_PDU_MAX) {
+		count(ENERGY_TX_UNSEG, 1U, len);
+	} else {
+		count(ENERGY_TX_SEG, ceiling_fraction(pdu, SEG_PDU_SIZE), len);
+	}
+}
+
+void energy_work(uint32_t start_cycles)
+{
+	uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - start_cycles);
+	k_spinlock_key_t key = k_spin_lock(&lock);
+
+	work_us += us;
+
+	k_spin_unlock(&lock, key);
+}
+
+const char *energy_event_name(enum energy_event event)
+{
+	return events[event].name;
+}
+
+static uint32_t to_uah(uint64_t nc)
+{
+	return nc / NC_PER_UAH;
+}
+
+void energy_report(struct energy_report *r)
+{
+	uint64_t nc, total = 0U;
+	k_spinlock_key_t key;
+	int i;
+
+	r->uptime_ms = k_uptime_get_32();
+	r->radio_rx_ms = MIN(friendship_radio_on_ms(), r->uptime_ms);
+
+	key = k_spin_lock(&lock);
+	memcpy(r->events, counters, sizeof(r->events));
+	r->work_ms = work_us / USEC_PER_MSEC;
+	nc = work_us * CPU_ACTIVE_NC_PER_US;
+	k_spin_unlock(&lock, key);
+
+	r->work_uah = to_uah(nc);
+	total += nc;
+
+	for (i = 0; i < ENERGY_EVENT_COUNT; i++) {
+		nc = (uint64_t)r->events[i].count * events[i].charge_nc +
+		     (uint64_t)r->events[i].bytes * TX_BYTE_NC;
+		r->event_uah[i] = to_uah(nc);
+		total += nc;
+	}
+
+	nc = (uint64_t)r->radio_rx_ms * RADIO_RX_NC_PER_MS;
+	r->radio_rx_uah = to_uah(nc);
+	total += nc;
+
+	nc = (uint64_t)r->uptime_ms * SLEEP_NC_PER_MS;
+	r->sleep_uah = to_uah(nc);
+	total += nc;
+
+	r->total_uah = to_uah(total);
+}
+
+void energy_print(void)
+{
+	static struct energy_report r;
+	uint32_t now = k_uptime_get_32();
+	int i;
+
+	energy_report(&r);
+
+	printk("Energy: %u.%03u mAh in %u s, radio rx %u.%03u mAh (%u s),"
+	       " app work %u.%03u mAh (%u ms), sleep %u.%03u mAh\n",
+	       r.total_uah / 1000U, r.total_uah % 1000U, r.uptime_ms / 1000U,
+	       r.radio_rx_uah / 1000U, r.radio_rx_uah % 1000U,
+	       r.radio_rx_ms / 1000U, r.work_uah / 1000U, r.work_uah % 1000U,
+	       r.work_ms, r.sleep_uah / 1000U, r.sleep_uah % 1000U);
+
+	for (i = 0; i < ENERGY_EVENT_COUNT; i++) {
+		if (!r.events[i].count) {
+			continue;
+		}
+
+		printk("  %-11s %6u x %7u B %u.%03u mAh, last %u s ago\n",
+		       events[i].name, r.events[i].count, r.events[i].bytes,
+		       r.event_uah[i] / 1000U, r.event_uah[i] % 1000U,
+		       (now - r.events[i].last) / 1000U);
+	}
+}
+
+static void update(struct k_work *work)
+{
+	/* Often enough for the screen, an e-paper redraw isn't free either */
+	board_model_changed(BOARD_MODEL_ENERGY);
+
+	k_delayed_work_submit(&update_work, ENERGY_UPDATE_INTERVAL);
+}
+
+int energy_init(void)
+{
+	k_delayed_work_init(&update_work, update);
+	k_delayed_work_submit(&update_work, ENERGY_UPDATE_INTERVAL);
+
+	return 0;
+}
@@ -0,0 +1,52 @@
+/*
+ * Energy accounting: the costly events are counted and time-stamped, and a
+ * simple model with a charge per event turns the counts into an estimate of
+ * the battery charge used.
+ */
+
+enum energy_event {
+	ENERGY_TX_UNSEG,
+	/* Counted per segment */
+	ENERGY_TX_SEG,
+	ENERGY_RELAY,
+	ENERGY_FETCH_HDC1010,
+	ENERGY_FETCH_MMA8652,
+	ENERGY_FETCH_APDS9960,
+	ENERGY_EPD_FULL,
+	ENERGY_EPD_PARTIAL,
+	ENERGY_EVENT_COUNT,
+};
+
+struct energy_counter {
+	uint32_t count;
+	uint32_t bytes;
+	/* Uptime of the latest one, in ms */
+	uint32_t last;
+};
+
+struct energy_report {
+	uint32_t uptime_ms;
+	uint32_t work_ms;
+	uint32_t radio_rx_ms;
+	struct energy_counter events[ENERGY_EVENT_COUNT];
+	/* Estimated charge, in uAh */
+	uint32_t event_uah[ENERGY_EVENT_COUNT];
+	uint32_t work_uah;
+	uint32_t radio_rx_uah;
+	uint32_t sleep_uah;
+	uint32_t total_uah;
+};
+
+void energy_count(enum energy_event event);
+/* Access message of len octets, opcode included, handed to the stack */
+void energy_tx(uint16_t len);
+/*
+ * Timed app work that started at the given cycle count is done: heartbeat
+ * publication, sensor fetches, redraws and the gateway drain
+ */
+void energy_work(uint32_t start_cycles);
+
+const char *energy_event_name(enum energy_event event);
+void energy_report(struct energy_report *r);
+void energy_print(void);
+int energy_init(void);
@@ -0,0 +1,191 @@
+/*
+ * E-paper text layer on top of the character framebuffer.
+ *
+ * The CFB draws glyphs by overwriting framebuffer bytes, so a row padded to
+ * the full line width with spaces replaces whatever was drawn there before.
+ * cfb_framebuffer_finalize() writes with the SSD16XX partial update waveform,
+ * cfb_framebuffer_clear(dev, true) does a full refresh.
+ */
+
+#include <zephyr.h>
+#include <device.h>
+#include <display/cfb.h>
+#include <sys/printk.h>
+
+#include <string.h>
+
+#include "epd.h"
+#include "energy.h"
+
+#define EPD_MAX_ROWS		7
+#define EPD_MAX_COLUMNS		25
+
+/* Partial updates between two full refreshes, and the longest time apart */
+#define EPD_PARTIAL_UPDATES_MAX		60
+#define EPD_FULL_REFRESH_INTERVAL_MS	(10 * 60 * MSEC_PER_SEC)
+
+static const struct font_info {
+	uint8_t columns;
+} fonts[] = {
+	[FONT_BIG] =    { .columns = 12 },
+	[FONT_MEDIUM] = { .columns = 16 },
+	[FONT_SMALL] =  { .columns = EPD_MAX_COLUMNS },
+};
+
+static const struct device *epd_dev;
+
+static struct {
+	char text[EPD_MAX_COLUMNS + 1];
+	bool used;
+} shadow[EPD_MAX_ROWS];
+
+static enum font_size shadow_font;
+static uint32_t touched;
+static uint32_t dirty;
+static bool invalid = true;
+static bool full_pending = true;
+static uint16_t partial_updates;
+static int64_t full_refresh_ts;
+
+int epd_init(const struct device *dev)
+{
+	epd_dev = dev;
+
+	if (cfb_framebuffer_init(dev)) {
+		return -EIO;
+	}
+
+	cfb_framebuffer_clear(dev, true);
+	energy_count(ENERGY_EPD_FULL);
+	full_refresh_ts = k_uptime_get();
+	full_pending = false;
+
+	return 0;
+}
+
+uint8_t epd_columns(enum font_size font_size)
+{
+	return fonts[font_size].columns;
+}
+
+void epd_invalidate(void)
+{
+	int row;
+
+	for (row = 0; row < EPD_MAX_ROWS; row++) {
+		shadow[row].used = false;
+	}
+
+	invalid = true;
+}
+
+void epd_full_refresh(void)
+{
+	full_pending = true;
+}
+
+size_t epd_print_line(enum font_size font_size, int row, const char *text,
+		      size_t len, bool center)
+{
+	uint8_t columns = fonts[font_size].columns;
+	char line[EPD_MAX_COLUMNS + 1];
+	int pad;
+
+	len = MIN(len, columns);
+
+	if (row < 0 || row >= EPD_MAX_ROWS) {
+		return len;
+	}
+
+	/* Rows of different fonts don't line up, start over */
+	if (font_size != shadow_font) {
+		shadow_font = font_size;
+		epd_invalidate();
+	}
+
+	pad = center ? (columns - len) / 2U : 0;
+
+	memset(line, ' ', columns);
+	memcpy(line + pad, text, len);
+	line[columns] = '\0';
+
+	touched |= BIT(row);
+
+	if (shadow[row].used && !strcmp(shadow[row].text, line)) {
+		return len;
+	}
+
+	strcpy(shadow[row].text, line);
+	shadow[row].used = true;
+	dirty |= BIT(row);
+
+	return len;
+}
+
+static bool full_refresh_due(int64_t now)
+{
+	return full_pending || partial_updates >= EPD_PARTIAL_UPDATES_MAX ||
+	       now - full_refresh_ts >= EPD_FULL_REFRESH_INTERVAL_MS;
+}
+
+int epd_commit(void)
+{
+	uint8_t font_width, font_height;
+	int64_t now = k_uptime_get();
+	int row, rows = 0;
+
+	/* Blank the rows the previous frame had but this one doesn't */
+	for (row = 0; row < EPD_MAX_ROWS; row++) {
+		if (shadow[row].used && !(touched & BIT(row))) {
+			memset(shadow[row].text, ' ',
+			       fonts[shadow_font].columns);
+			shadow[row].used = false;
+			dirty |= BIT(row);
+		}
+	}
+
+	touched = 0U;
+
+	if (!dirty && !invalid && !full_pending) {
+		return 0;
+	}
+
+	if (full_refresh_due(now)) {
+		cfb_framebuffer_clear(epd_dev, true);
+		energy_count(ENERGY_EPD_FULL);
+		full_refresh_ts = now;
+		full_pending = false;
+		partial_updates = 0U;
+		invalid = true;
+	} else {
+		energy_count(ENERGY_EPD_PARTIAL);
+		partial_updates++;
+	}
+
+	if (invalid) {
+		cfb_framebuffer_clear(epd_dev, false);
+	}
+
+	cfb_framebuffer_set_font(epd_dev, shadow_font);
+	cfb_get_font_size(epd_dev, shadow_font, &font_width, &font_height);
+
+	for (row = 0; row < EPD_MAX_ROWS; row++) {
+		if (!(dirty & BIT(row)) && !(invalid && shadow[row].used)) {
+			continue;
+		}
+
+		if (cfb_print(epd_dev, shadow[row].text, 0,
+			      font_height * row)) {
+			printk("Failed to print a string\n");
+		}
+
+		rows++;
+	}
+
+	dirty = 0U;
+	invalid = false;
+
+	cfb_framebuffer_finalize(epd_dev);
+
+	return rows;
+}
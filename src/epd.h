@@ -0,0 +1,32 @@
+/*
+ * E-paper text layer on top of the character framebuffer. It keeps a shadow
+ * of every text row and only rewrites the rows whose text changed, using the
+ * SSD16XX partial update waveform. A full refresh runs now and then to clear
+ * the ghosting partial updates leave behind.
+ */
+
+enum font_size {
+	FONT_SMALL = 0,
+	FONT_MEDIUM = 1,
+	FONT_BIG = 2,
+};
+
+int epd_init(const struct device *dev);
+uint8_t epd_columns(enum font_size font_size);
+
+/* Queue a text row of the current frame, returns the characters used */
+size_t epd_print_line(enum font_size font_size, int row, const char *text,
+		      size_t len, bool center);
+
+/*
+ * Finish the current frame: rows not printed since the previous commit are
+ * blanked, and the panel is updated only if a row changed. Returns the number
+ * of rows written to the panel.
+ */
+int epd_commit(void);
+
+/* Rewrite every row on the next commit */
+void epd_invalidate(void);
+
+/* Force a full refresh on the next commit */
+void epd_full_refresh(void);
@@ -0,0 +1,102 @@
+/*
+ * Fixed point formatting. The values are exact in their decimals, so
+ * unlike a float printf there is no rounding to do.
+ */
+
+#include <zephyr/types.h>
+
+#include "fmt.h"
+
+static const uint32_t pow10[FMT_DECIMALS_MAX + 1] = {
+	1, 10, 100, 1000, 10000, 100000, 1000000,
+};
+
+/* At least digits digits, with leading zeros */
+static char *put_uint(char *buf, uint32_t val, uint8_t digits)
+{
+	char tmp[10];
+	uint8_t len = 0U;
+
+	do {
+		tmp[len++] = '0' + val % 10U;
+		val /= 10U;
+	} while (val || len < digits);
+
+	while (len) {
+		*buf++ = tmp[--len];
+	}
+
+	*buf = '\0';
+
+	return buf;
+}
+
+/* The magnitude as unsigned, INT32_MIN included */
+static uint32_t magnitude(int32_t val)
+{
+	return val < 0 ? 0U - (uint32_t)val : (uint32_t)val;
+}
+
+char *fmt_str(char *buf, const char *str)
+{
+	while (*str) {
+		*buf++ = *str++;
+	}
+
+	*buf = '\0';
+
+	return buf;
+}
+
+char *fmt_int(char *buf, int32_t val)
+{
+	if (val < 0) {
+		*buf++ = '-';
+	}
+
+	return put_uint(buf, magnitude(val), 1);
+}
+
+char *fmt_hex16(char *buf, uint16_t val)
+{
+	static const char digits[] = "0123456789abcdef";
+	int shift;
+
+	for (shift = 12; shift >= 0; shift -= 4) {
+		*buf++ = digits[(val >> shift) & 0xf];
+	}
+
+	*buf = '\0';
+
+	return buf;
+}
+
+char *fmt_fixed(char *buf, int32_t val, uint8_t decimals, uint8_t width)
+{
+	/* Sign, 10 digits, point and decimals */
+	char tmp[1 + 10 + 1 + FMT_DECIMALS_MAX + 1];
+	uint32_t mag = magnitude(val);
+	char *end = tmp;
+
+	if (decimals > FMT_DECIMALS_MAX) {
+		decimals = FMT_DECIMALS_MAX;
+	}
+
+	if (val < 0) {
+		*end++ = '-';
+	}
+
+	end = put_uint(end, mag / pow10[decimals], 1);
+
+	if (decimals) {
+		*end++ = '.';
+		end = put_uint(end, mag % pow10[decimals], decimals);
+	}
+
+	while (width > end - tmp) {
+		*buf++ = ' ';
+		width--;
+	}
+
+	return fmt_str(buf, tmp);
+}
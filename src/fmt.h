@@ -0,0 +1,19 @@
+/*
+ * Text formatting of fixed point values and addresses, without the float
+ * printf of the C library. A value kept with N decimals prints the same as
+ * "%.Nf" of the value divided by 10^N would.
+ *
+ * Every call writes at buf, terminates the string and returns its end, so
+ * calls chain. The caller sizes the buffer.
+ */
+
+#define FMT_DECIMALS_MAX	6
+
+/* "%s" */
+char *fmt_str(char *buf, const char *str);
+/* "%d" */
+char *fmt_int(char *buf, int32_t val);
+/* "%04x" */
+char *fmt_hex16(char *buf, uint16_t val);
+/* "%*.*f", right aligned in width characters, 0 for none */
+char *fmt_fixed(char *buf, int32_t val, uint8_t decimals, uint8_t width);
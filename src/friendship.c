@@ -0,0 +1,179 @@
+/*
+ * Friendship roles, picked at build time with overlay-badge.conf (Low Power
+ * Node) or overlay-anchor.conf (Friend).
+ *
+ * On a badge the stack polls its Friend on its own within the poll timeout.
+ * On top of that the app polls once per poll interval, and tunes the
+ * interval to the number of PDUs each poll brought, every segment of a
+ * heartbeat takes a slot of the Friend queue: a busy Friend queue is emptied
+ * before it overflows, a quiet one is left alone longer.
+ */
+
+#include <zephyr.h>
+#include <sys/printk.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/mesh.h>
+
+#include "mesh.h"
+#include "mesh_app.h"
+#include "friendship.h"
+
+#define POLL_INTERVAL_MIN_MS	(1 * MSEC_PER_SEC)
+#define POLL_INTERVAL_MAX_MS	(30 * MSEC_PER_SEC)
+
+/* Zephyr's default Friend receive window, the radio is on at most this long */
+#define FRIEND_RECV_WIN_MS	255
+
+#if defined(CONFIG_BT_MESH_LOW_POWER)
+/* PDUs of the Friend queue the badge asks for */
+#define FRIEND_QUEUE_PDUS	BIT(CONFIG_BT_MESH_LPN_MIN_QUEUE_SIZE)
+
+/* From there the queue can't take one more heartbeat of the largest size */
+#define POLL_BUSY_PDUS		(FRIEND_QUEUE_PDUS - HEARTBEAT_SEGS)
+
+BUILD_ASSERT(HEARTBEAT_SEGS <= FRIEND_QUEUE_PDUS,
+	     "Friend queue can't hold the largest heartbeat");
+BUILD_ASSERT(2 * HEARTBEAT_SEGS <= FRIEND_QUEUE_PDUS,
+	     "Friend queue overflows before the poll interval shortens");
+#else
+#define POLL_BUSY_PDUS		1
+#endif
+
+static struct {
+	uint16_t friend_addr;
+	uint32_t poll_interval;
+	uint16_t pdus_since_poll;
+	uint32_t polls;
+	/* Time spent with and without a Friend, for the radio-on estimate */
+	uint32_t established_ms;
+	uint32_t scanning_ms;
+	uint32_t since;
+} lpn;
+
+static struct k_delayed_work poll_work;
+
+static void lpn_account(void)
+{
+	uint32_t now = k_uptime_get_32();
+
+	if (lpn.friend_addr != BT_MESH_ADDR_UNASSIGNED) {
+		lpn.established_ms += now - lpn.since;
+	} else {
+		lpn.scanning_ms += now - lpn.since;
+	}
+
+	lpn.since = now;
+}
+
+static void poll(struct k_work *work)
+{
+	/* bt_mesh_lpn_poll() is only built with Low Power */
+	if (!IS_ENABLED(CONFIG_BT_MESH_LOW_POWER) ||
+	    lpn.friend_addr == BT_MESH_ADDR_UNASSIGNED) {
+		return;
+	}
+
+	if (lpn.pdus_since_poll >= POLL_BUSY_PDUS) {
+		lpn.poll_interval = MAX(lpn.poll_interval / 2,
+				       POLL_INTERVAL_MIN_MS);
+	} else if (!lpn.pdus_since_poll) {
+		lpn.poll_interval = MIN(lpn.poll_interval * 2,
+				       POLL_INTERVAL_MAX_MS);
+	}
+
+	lpn.pdus_since_poll = 0U;
+
+	if (!bt_mesh_lpn_poll()) {
+		lpn.polls++;
+	}
+
+	k_delayed_work_submit(&poll_work, K_MSEC(lpn.poll_interval));
+}
+
+static void lpn_changed(uint16_t friend_addr, bool established)
+{
+	lpn_account();
+
+	if (established) {
+		printk("Friendship with 0x%04x established\n", friend_addr);
+		lpn.friend_addr = friend_addr;
+		lpn.poll_interval = HEARTBEAT_PERIOD_SEC * MSEC_PER_SEC;
+		k_delayed_work_submit(&poll_work, K_MSEC(lpn.poll_interval));
+	} else {
+		printk("Friendship with 0x%04x lost\n", friend_addr);
+		lpn.friend_addr = BT_MESH_ADDR_UNASSIGNED;
+		k_delayed_work_cancel(&poll_work);
+	}
+}
+
+void friendship_start(void)
+{
+	int err;
+
+	if (IS_ENABLED(CONFIG_BT_MESH_LOW_POWER)) {
+		lpn.since = k_uptime_get_32();
+
+		err = bt_mesh_lpn_set(true);
+		if (err && err != -EALREADY) {
+			printk("Enabling Low Power failed (err %d)\n", err);
+		}
+	}
+
+	if (IS_ENABLED(CONFIG_BT_MESH_FRIEND)) {
+		mesh_friend_set(true);
+	}
+}
+
+/* Heartbeat of pdus PDUs received, with a Friend it came out of its queue */
+void friendship_rx(uint8_t pdus)
+{
+	lpn.pdus_since_poll = MIN(lpn.pdus_since_poll + pdus, UINT16_MAX);
+}
+
+uint32_t friendship_radio_on_ms(void)
+{
+	if (!IS_ENABLED(CONFIG_BT_MESH_LOW_POWER)) {
+		return k_uptime_get_32();
+	}
+
+	lpn_account();
+
+	/*
+	 * Scanning all the time without a Friend, a window per poll with one.
+	 * The stack polls on its own too, at most once per poll timeout.
+	 */
+	return lpn.scanning_ms +
+	       MIN(lpn.polls * FRIEND_RECV_WIN_MS, lpn.established_ms);
+}
+
+void friendship_print(void)
+{
+	uint32_t total, radio_on;
+
+	if (!IS_ENABLED(CONFIG_BT_MESH_LOW_POWER)) {
+		return;
+	}
+
+	radio_on = friendship_radio_on_ms();
+
+	total = lpn.established_ms + lpn.scanning_ms;
+	if (!total) {
+		return;
+	}
+
+	printk("Low Power: friend 0x%04x, poll %u ms, %u polls,"
+	       " radio on about %u%% of the time\n",
+	       lpn.friend_addr, lpn.poll_interval, lpn.polls,
+	       (uint32_t)((uint64_t)radio_on * 100U / total));
+}
+
+int friendship_init(void)
+{
+	if (IS_ENABLED(CONFIG_BT_MESH_LOW_POWER)) {
+		k_delayed_work_init(&poll_work, poll);
+		bt_mesh_lpn_set_cb(lpn_changed);
+	}
+
+	return 0;
+}
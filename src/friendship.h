@@ -0,0 +1,12 @@
+/*
+ * Friendship roles: battery badges built with the Low Power feature poll a
+ * Friend instead of scanning, mains powered anchors built with the Friend
+ * feature keep the messages for them.
+ */
+
+void friendship_start(void);
+void friendship_rx(uint8_t pdus);
+/* Time the radio spent receiving, estimated for a Low Power Node */
+uint32_t friendship_radio_on_ms(void);
+void friendship_print(void);
+int friendship_init(void);
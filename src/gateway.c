@@ -0,0 +1,487 @@
+/*
+ * Gateway role: node records streamed over the console UART as binary
+ * frames. Records wait in the uplink queue until the ring buffer feeding the
+ * UART has room for them, and the ring buffer is sent with the asynchronous
+ * UART API when the driver has it, polled out otherwise.
+ */
+
+#include <zephyr.h>
+#include <string.h>
+#include <sys/printk.h>
+#include <sys/crc.h>
+#include <sys/byteorder.h>
+#include <sys/ring_buffer.h>
+#include <drivers/uart.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/mesh.h>
+
+#include "mesh.h"
+#include "mesh_app.h"
+#include "aggregate.h"
+#include "uplink.h"
+#include "gateway.h"
+#include "energy.h"
+#include "trace.h"
+#include "diag.h"
+
+#define GATEWAY_SYNC_0		0xaa
+#define GATEWAY_SYNC_1		0x55
+#define GATEWAY_HDR_SIZE	4
+#define GATEWAY_CRC_SIZE	2
+#define GATEWAY_PAYLOAD_MAX	UINT8_MAX
+
+#define GATEWAY_FRAME_OVERHEAD	(GATEWAY_HDR_SIZE + GATEWAY_CRC_SIZE)
+
+#define GATEWAY_TX_BUF_SIZE	1024
+#define GATEWAY_STACK_SIZE	1024
+
+#define NODE_HDR_SIZE		(2 + 1 + 2 + 1 + 1 + 1)
+#define NODE_NEIGHBOR_SIZE	(2 + 1)
+#define AGGREGATE_HDR_SIZE	(1 + 2 + 2 + 4 + 1)
+#define AGGREGATE_EDGE_SIZE	(2 + 2 + 1)
+#define LATENCY_HDR_SIZE	(1 + TRACE_HOPS * TRACE_BINS + 1 + 1 + 1)
+#define LATENCY_SOURCE_SIZE	(2 + 2 + 2)
+#define LATENCY_FRAME_SOURCES	((GATEWAY_PAYLOAD_MAX - LATENCY_HDR_SIZE) / \
+				 LATENCY_SOURCE_SIZE)
+#define HEALTH_HDR_SIZE		(2 + 1)
+
+BUILD_ASSERT(AGGREGATE_HDR_SIZE + AGGREGATE_EDGES_MAX * AGGREGATE_EDGE_SIZE <=
+	     GATEWAY_PAYLOAD_MAX, "Aggregate frame doesn't fit");
+
+BUILD_ASSERT(LATENCY_FRAME_SOURCES > 0, "Latency frame doesn't fit");
+
+BUILD_ASSERT(HEALTH_HDR_SIZE + DIAG_PAGES_MAX * DIAG_PAGE_SIZE <=
+	     GATEWAY_PAYLOAD_MAX, "Health frame doesn't fit");
+
+BUILD_ASSERT(NODE_HDR_SIZE + MAX_NODES * NODE_NEIGHBOR_SIZE <=
+	     UPLINK_RECORD_MAX, "Node record doesn't fit the uplink queue");
+
+/* Staging for the UART, filled from the uplink queue while there's room */
+RING_BUF_DECLARE(tx_ring, GATEWAY_TX_BUF_SIZE);
+
+/*
+ * The drain runs on its own queue, so a UART that blocks in poll mode
+ * doesn't hold up the mesh work on the system work queue.
+ */
+K_THREAD_STACK_DEFINE(gateway_stack, GATEWAY_STACK_SIZE);
+static struct k_work_q gateway_wq;
+static struct k_work drain_work;
+
+static const struct device *uart;
+static struct k_spinlock lock;
+static bool enabled;
+#ifdef CONFIG_UART_ASYNC_API
+static bool tx_async;
+static bool tx_busy;
+#endif
+
+static struct uplink_queue uplink;
+
+/* Latest sink view, only the newest one is ever sent */
+static struct aggregate_report aggregate;
+static bool aggregate_pending;
+static struct trace_report latency;
+static bool latency_pending;
+static struct diag_dump health;
+static bool health_pending;
+static uint32_t tx_high_water;
+
+static uint8_t distance_dm(uint16_t distance_cm)
+{
+	return MIN(distance_cm / 10U, UINT8_MAX);
+}
+
+static void frame_put(uint8_t type, const uint8_t *payload, uint8_t len)
+{
+	uint8_t hdr[GATEWAY_HDR_SIZE] = {
+		GATEWAY_SYNC_0, GATEWAY_SYNC_1, len, type,
+	};
+	uint8_t crc[GATEWAY_CRC_SIZE];
+	k_spinlock_key_t key;
+	uint16_t sum;
+
+	sum = crc16_ccitt(0xffff, &hdr[2], 2);
+	sum = crc16_ccitt(sum, payload, len);
+	sys_put_le16(sum, crc);
+
+	/* Only called with room for the frame, the drain checked it */
+	key = k_spin_lock(&lock);
+	ring_buf_put(&tx_ring, hdr, sizeof(hdr));
+	ring_buf_put(&tx_ring, payload, len);
+	ring_buf_put(&tx_ring, crc, sizeof(crc));
+	tx_high_water = MAX(tx_high_water,
+			    GATEWAY_TX_BUF_SIZE - ring_buf_space_get(&tx_ring));
+	k_spin_unlock(&lock, key);
+}
+
+static void aggregate_frame_put(const struct aggregate_report *r)
+{
+	NET_BUF_SIMPLE_DEFINE(buf, GATEWAY_PAYLOAD_MAX);
+	int i;
+
+	net_buf_simple_add_u8(&buf, r->nodes);
+	net_buf_simple_add_le16(&buf, r->temp_min);
+	net_buf_simple_add_le16(&buf, r->temp_max);
+	net_buf_simple_add_le32(&buf, r->temp_sum);
+	net_buf_simple_add_u8(&buf, r->edge_count);
+
+	for (i = 0; i < r->edge_count; i++) {
+		net_buf_simple_add_le16(&buf, r->edges[i].a);
+		net_buf_simple_add_le16(&buf, r->edges[i].b);
+		net_buf_simple_add_u8(&buf, r->edges[i].distance);
+	}
+
+	frame_put(GATEWAY_FRAME_AGGREGATE, buf.data, buf.len);
+}
+
+/* One frame of the report from source first on, returns the next one */
+static uint8_t latency_frame_put(const struct trace_report *r, uint8_t first)
+{
+	NET_BUF_SIMPLE_DEFINE(buf, GATEWAY_PAYLOAD_MAX);
+	uint8_t count = MIN(r->source_count - first, LATENCY_FRAME_SOURCES);
+	int i;
+
+	net_buf_simple_add_u8(&buf, TRACE_HOPS);
+	for (i = 0; i < TRACE_HOPS; i++) {
+		net_buf_simple_add_mem(&buf, r->hops[i].bins, TRACE_BINS);
+	}
+
+	net_buf_simple_add_u8(&buf, r->source_count);
+	net_buf_simple_add_u8(&buf, first);
+	net_buf_simple_add_u8(&buf, count);
+	for (i = first; i < first + count; i++) {
+		net_buf_simple_add_le16(&buf, r->sources[i].addr);
+		net_buf_simple_add_le16(&buf, r->sources[i].p50);
+		net_buf_simple_add_le16(&buf, r->sources[i].p90);
+	}
+
+	frame_put(GATEWAY_FRAME_LATENCY, buf.data, buf.len);
+
+	return first + count;
+}
+
+static void health_frame_put(const struct diag_dump *d)
+{
+	NET_BUF_SIMPLE_DEFINE(buf, GATEWAY_PAYLOAD_MAX);
+
+	net_buf_simple_add_le16(&buf, d->addr);
+	net_buf_simple_add_u8(&buf, d->page_count);
+	net_buf_simple_add_mem(&buf, d->pages, d->page_count * DIAG_PAGE_SIZE);
+
+	frame_put(GATEWAY_FRAME_HEALTH, buf.data, buf.len);
+}
+
+/* Move queued records into the ring buffer while whole frames fit */
+static void tx_fill(void)
+{
+	static struct aggregate_report report;
+	static struct trace_report trace;
+	/* Next source of trace to send, it may take several frames */
+	static uint8_t trace_next;
+	static bool trace_more;
+	static struct diag_dump dump;
+	struct uplink_record rec;
+	k_spinlock_key_t key;
+	bool has_record, has_aggregate, has_latency, has_health;
+	uint32_t space;
+
+	for (;;) {
+		key = k_spin_lock(&lock);
+
+		space = ring_buf_space_get(&tx_ring);
+
+		has_record = space >= GATEWAY_FRAME_OVERHEAD + UPLINK_RECORD_MAX &&
+			     uplink_queue_get(&uplink, &rec);
+
+		has_aggregate = !has_record && aggregate_pending &&
+				space >= GATEWAY_FRAME_OVERHEAD +
+					 GATEWAY_PAYLOAD_MAX;
+		if (has_aggregate) {
+			memcpy(&report, &aggregate, sizeof(report));
+			aggregate_pending = false;
+		}
+
+		/* A newer report replaces the rest of the one being sent */
+		has_latency = !has_record && !has_aggregate &&
+			      (latency_pending || trace_more) &&
+			      space >= GATEWAY_FRAME_OVERHEAD +
+				       GATEWAY_PAYLOAD_MAX;
+		if (has_latency && latency_pending) {
+			memcpy(&trace, &latency, sizeof(trace));
+			latency_pending = false;
+			trace_next = 0U;
+		}
+
+		has_health = !has_record && !has_aggregate && !has_latency &&
+			     health_pending &&
+			     space >= GATEWAY_FRAME_OVERHEAD +
+				      GATEWAY_PAYLOAD_MAX;
+		if (has_health) {
+			memcpy(&dump, &health, sizeof(dump));
+			health_pending = false;
+		}
+
+		k_spin_unlock(&lock, key);
+
+		if (has_record) {
+			frame_put(GATEWAY_FRAME_NODE, rec.data, rec.len);
+		} else if (has_aggregate) {
+			aggregate_frame_put(&report);
+		} else if (has_latency) {
+			trace_next = latency_frame_put(&trace, trace_next);
+			trace_more = trace_next < trace.source_count;
+		} else if (has_health) {
+			health_frame_put(&dump);
+		} else {
+			return;
+		}
+	}
+}
+
+/*
+ * printk() shares the UART and polls it out as well, a line from another
+ * thread would land in the middle of a frame. Every frame goes out with the
+ * scheduler locked, so other threads only print between frames; a full frame
+ * holds them off for about 23 ms at 115200 baud.
+ */
+static uint32_t tx_poll(void)
+{
+	static uint8_t frame[GATEWAY_FRAME_OVERHEAD + GATEWAY_PAYLOAD_MAX];
+	k_spinlock_key_t key;
+	uint32_t len, i, total = 0U;
+
+	for (;;) {
+		/* The ring only ever holds whole frames, see frame_put() */
+		key = k_spin_lock(&lock);
+		len = ring_buf_get(&tx_ring, frame, GATEWAY_HDR_SIZE);
+		if (len) {
+			len += ring_buf_get(&tx_ring, &frame[len],
+					    frame[2] + GATEWAY_CRC_SIZE);
+		}
+		k_spin_unlock(&lock, key);
+
+		if (!len) {
+			return total;
+		}
+
+		k_sched_lock();
+		for (i = 0; i < len; i++) {
+			uart_poll_out(uart, frame[i]);
+		}
+		k_sched_unlock();
+
+		total += len;
+	}
+}
+
+#ifdef CONFIG_UART_ASYNC_API
+static void tx_start(void)
+{
+	k_spinlock_key_t key;
+	uint8_t *data;
+	uint32_t len;
+
+	key = k_spin_lock(&lock);
+
+	if (!tx_busy) {
+		len = ring_buf_get_claim(&tx_ring, &data, GATEWAY_TX_BUF_SIZE);
+
+		if (len && !uart_tx(uart, data, len, SYS_FOREVER_MS)) {
+			tx_busy = true;
+		} else {
+			ring_buf_get_finish(&tx_ring, 0);
+		}
+	}
+
+	k_spin_unlock(&lock, key);
+}
+
+static void uart_cb(const struct device *dev, struct uart_event *evt,
+		    void *user_data)
+{
+	k_spinlock_key_t key;
+
+	switch (evt->type) {
+	case UART_TX_DONE:
+	case UART_TX_ABORTED:
+		key = k_spin_lock(&lock);
+		ring_buf_get_finish(&tx_ring, evt->data.tx.len);
+		tx_busy = false;
+		k_spin_unlock(&lock, key);
+
+		/* The consumer is back, refill from the queue */
+		k_work_submit_to_queue(&gateway_wq, &drain_work);
+		break;
+	default:
+		break;
+	}
+}
+#endif
+
+static void drain(struct k_work *work)
+{
+	uint32_t start = k_cycle_get_32();
+
+#ifdef CONFIG_UART_ASYNC_API
+	if (tx_async) {
+		tx_fill();
+		tx_start();
+		energy_work(start);
+		return;
+	}
+#endif
+
+	do {
+		tx_fill();
+	} while (tx_poll());
+
+	energy_work(start);
+}
+
+void gateway_node_update(const struct node_data *n)
+{
+	NET_BUF_SIMPLE_DEFINE(buf, UPLINK_RECORD_MAX);
+	k_spinlock_key_t key;
+	uint8_t *count;
+	int i;
+
+	if (!enabled) {
+		return;
+	}
+
+	net_buf_simple_add_le16(&buf, n->address);
+	net_buf_simple_add_u8(&buf, n->rssi);
+	net_buf_simple_add_le16(&buf, n->temperature * 10);
+	net_buf_simple_add_u8(&buf, n->humidity);
+	net_buf_simple_add_u8(&buf, distance_dm(n->filtered_distance));
+
+	count = net_buf_simple_add(&buf, 1);
+	*count = 0U;
+
+	for (i = 0; i < n->neighbor_count &&
+	     net_buf_simple_tailroom(&buf) >= NODE_NEIGHBOR_SIZE; i++) {
+		const struct neighbor_distance *d = &n->neighbor_distances[i];
+
+		net_buf_simple_add_le16(&buf, d->address);
+		net_buf_simple_add_u8(&buf, MIN(d->distance, UINT8_MAX));
+		(*count)++;
+	}
+
+	key = k_spin_lock(&lock);
+	uplink_queue_put(&uplink, n->address, buf.data, buf.len);
+	k_spin_unlock(&lock, key);
+
+	k_work_submit_to_queue(&gateway_wq, &drain_work);
+}
+
+void gateway_aggregate_update(const struct aggregate_report *r)
+{
+	k_spinlock_key_t key;
+
+	if (!enabled) {
+		return;
+	}
+
+	key = k_spin_lock(&lock);
+	memcpy(&aggregate, r, sizeof(aggregate));
+	aggregate_pending = true;
+	k_spin_unlock(&lock, key);
+
+	k_work_submit_to_queue(&gateway_wq, &drain_work);
+}
+
+void gateway_latency_update(const struct trace_report *r)
+{
+	k_spinlock_key_t key;
+
+	if (!enabled) {
+		return;
+	}
+
+	key = k_spin_lock(&lock);
+	memcpy(&latency, r, sizeof(latency));
+	latency_pending = true;
+	k_spin_unlock(&lock, key);
+
+	k_work_submit_to_queue(&gateway_wq, &drain_work);
+}
+
+void gateway_health_update(const struct diag_dump *d)
+{
+	k_spinlock_key_t key;
+
+	if (!enabled) {
+		return;
+	}
+
+	key = k_spin_lock(&lock);
+	memcpy(&health, d, sizeof(health));
+	health_pending = true;
+	k_spin_unlock(&lock, key);
+
+	k_work_submit_to_queue(&gateway_wq, &drain_work);
+}
+
+void gateway_queue_stats(struct gateway_queue_stats *s)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+
+	s->uplink_high_water = uplink.high_water;
+	s->uplink_dropped = uplink.dropped;
+	s->tx_high_water = tx_high_water;
+
+	k_spin_unlock(&lock, key);
+}
+
+void gateway_print(void)
+{
+	if (!enabled) {
+		return;
+	}
+
+	printk("Gateway uplink: %u queued, %u coalesced, %u dropped\n",
+	       uplink.count, uplink.coalesced, uplink.dropped);
+}
+
+void gateway_set_enabled(bool enable)
+{
+	if (!uart) {
+		return;
+	}
+
+	enabled = enable;
+
+	/* The gateway is where the aggregated readings have to end up */
+	if (MESH_AGGREGATE) {
+		aggregate_sink_set(enable);
+	}
+
+	printk("Gateway %s\n", enable ? "on" : "off");
+}
+
+bool gateway_is_enabled(void)
+{
+	return enabled;
+}
+
+int gateway_init(void)
+{
+	uart = device_get_binding(CONFIG_UART_CONSOLE_ON_DEV_NAME);
+	if (!uart) {
+		return -ENODEV;
+	}
+
+	uplink_queue_init(&uplink);
+
+	k_work_init(&drain_work, drain);
+	k_work_q_start(&gateway_wq, gateway_stack,
+		       K_THREAD_STACK_SIZEOF(gateway_stack),
+		       K_LOWEST_APPLICATION_THREAD_PRIO);
+
+#ifdef CONFIG_UART_ASYNC_API
+	tx_async = !uart_callback_set(uart, uart_cb, NULL);
+#endif
+
+	return 0;
+}
@@ -0,0 +1,62 @@
+/*
+ * Gateway role: node records streamed over the console UART as binary
+ * frames, interleaved with the console text.
+ *
+ * Frame: sync (0xaa 0x55), payload length (u8), type (u8), payload,
+ * CRC-16/CCITT (seed 0xffff, little endian) over length, type and payload.
+ * All the payload fields are little endian. tools/gateway_decode.py turns
+ * the stream into a live table.
+ */
+
+enum gateway_frame_type {
+	/*
+	 * addr (u16), rssi (s8), temperature (s16, 0.01 C), humidity (u8),
+	 * distance to the gateway (u8, dm), neighbor count (u8), then per
+	 * neighbor: addr (u16), distance (u8, dm)
+	 */
+	GATEWAY_FRAME_NODE = 0x01,
+	/*
+	 * nodes (u8), temperature min, max (s16, 0.01 C), sum (s32),
+	 * edge count (u8), then per edge: addr (u16), addr (u16), distance (u8)
+	 */
+	GATEWAY_FRAME_AGGREGATE = 0x02,
+	/*
+	 * hop buckets (u8), then per bucket the heartbeat latency histogram
+	 * (8 x u8), source count of the report (u8), index of the first
+	 * source of this frame (u8), sources in this frame (u8), then per
+	 * source: addr (u16), p50 (u16, ms), p90 (u16, ms). A report with
+	 * more sources than fit a frame goes out in several, the first one
+	 * starting at index 0.
+	 */
+	GATEWAY_FRAME_LATENCY = 0x03,
+	/*
+	 * addr (u16), page count (u8), then the diagnostic pages of the node,
+	 * 7 octets each, see diag.h
+	 */
+	GATEWAY_FRAME_HEALTH = 0x04,
+};
+
+struct gateway_queue_stats {
+	/* Most records ever waiting in the uplink queue */
+	uint8_t uplink_high_water;
+	uint32_t uplink_dropped;
+	/* Most octets ever waiting for the UART */
+	uint32_t tx_high_water;
+};
+
+struct node_data;
+struct aggregate_report;
+struct trace_report;
+struct diag_dump;
+
+void gateway_node_update(const struct node_data *n);
+void gateway_aggregate_update(const struct aggregate_report *r);
+void gateway_latency_update(const struct trace_report *r);
+void gateway_health_update(const struct diag_dump *d);
+void gateway_queue_stats(struct gateway_queue_stats *s);
+void gateway_print(void);
+
+void gateway_set_enabled(bool enable);
+bool gateway_is_enabled(void);
+
+int gateway_init(void);
@@ -0,0 +1,133 @@
+/*
+ * Per-neighbor link quality: heartbeat loss from the sequence numbers,
+ * inter-arrival jitter against the publish period announced by the sender,
+ * and hop count and RSSI histograms. Everything lives in a fixed size record.
+ */
+
+#include <zephyr.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "link_quality.h"
+
+/* Halve the counters past this, so the loss follows recent behavior */
+#define LINK_WINDOW_MAX		1024
+
+static void histogram_add(uint8_t *bins, size_t count, size_t bin)
+{
+	size_t i;
+
+	if (bins[bin] == UINT8_MAX) {
+		for (i = 0; i < count; i++) {
+			bins[i] /= 2U;
+		}
+	}
+
+	bins[bin]++;
+}
+
+static void link_quality_sample(struct link_quality *lq, uint8_t hops,
+				int8_t rssi)
+{
+	int bin;
+
+	histogram_add(lq->hops, LINK_HOP_BUCKETS,
+		      CLAMP(hops, 1, LINK_HOP_BUCKETS) - 1);
+
+	bin = (rssi - LINK_RSSI_MIN) / LINK_RSSI_BIN_WIDTH;
+	histogram_add(lq->rssi, LINK_RSSI_BINS,
+		      CLAMP(bin, 0, LINK_RSSI_BINS - 1));
+}
+
+void link_quality_update(struct link_quality *lq, uint16_t seq, uint8_t hops,
+			 int8_t rssi, uint32_t now, uint8_t period)
+{
+	int16_t delta = seq - lq->last_seq;
+	/* The most heartbeats the sender can have sent since, with margin */
+	uint32_t possible = 2U * (now - lq->last_rx) /
+			    (MAX(lq->period, 1U) * MSEC_PER_SEC) + 2U;
+	int32_t deviation;
+
+	/* Echoes and stale copies were dropped by the sequence window */
+	if (!lq->received || delta <= 0 || (uint16_t)delta > possible) {
+		/*
+		 * First heartbeat, or the sender restarted its sequence, from
+		 * a random value
+		 */
+		lq->expected = 1U;
+		lq->received = 1U;
+	} else {
+		lq->expected += delta;
+		lq->received++;
+
+		/* Measured against the period the previous heartbeat announced */
+		deviation = (int32_t)(now - lq->last_rx) -
+			    delta * lq->period * MSEC_PER_SEC;
+		lq->jitter += ((int32_t)abs(deviation) - lq->jitter) / 16;
+	}
+
+	if (lq->expected >= LINK_WINDOW_MAX) {
+		lq->expected /= 2U;
+		lq->received /= 2U;
+	}
+
+	lq->last_seq = seq;
+	lq->last_rx = now;
+	lq->period = period;
+
+	link_quality_sample(lq, hops, rssi);
+}
+
+void link_quality_reject(struct link_quality *lq, bool stale)
+{
+	uint16_t *count = stale ? &lq->stale : &lq->duplicates;
+
+	if (*count < UINT16_MAX) {
+		(*count)++;
+	}
+}
+
+uint16_t link_quality_loss(const struct link_quality *lq, uint32_t now)
+{
+	uint32_t expected = lq->expected;
+	uint32_t overdue;
+
+	if (!expected || !lq->period) {
+		return 0;
+	}
+
+	overdue = (now - lq->last_rx) / (lq->period * MSEC_PER_SEC);
+	if (overdue > 1) {
+		expected += overdue - 1;
+	}
+
+	return (expected - MIN(lq->received, expected)) * 1000U / expected;
+}
+
+int8_t link_quality_rssi_percentile(const struct link_quality *lq,
+				    uint8_t percent)
+{
+	uint32_t total = 0U, target, sum = 0U;
+	int i;
+
+	for (i = 0; i < LINK_RSSI_BINS; i++) {
+		total += lq->rssi[i];
+	}
+
+	if (!total) {
+		return 0;
+	}
+
+	target = (total * percent + 99U) / 100U;
+
+	for (i = 0; i < LINK_RSSI_BINS - 1; i++) {
+		sum += lq->rssi[i];
+		if (sum >= target) {
+			break;
+		}
+	}
+
+	/* Middle of the bin */
+	return LINK_RSSI_MIN + i * LINK_RSSI_BIN_WIDTH +
+	       LINK_RSSI_BIN_WIDTH / 2;
+}
@@ -0,0 +1,38 @@
+/*
+ * Per-neighbor link quality: heartbeat loss from the sequence numbers,
+ * inter-arrival jitter against the publish period announced by the sender,
+ * and hop count and RSSI histograms. Everything lives in a fixed size record.
+ */
+
+#define LINK_HOP_BUCKETS	5
+
+#define LINK_RSSI_MIN		-100
+#define LINK_RSSI_BIN_WIDTH	5
+#define LINK_RSSI_BINS		14
+
+struct link_quality {
+	uint16_t last_seq;
+	/* Heartbeats sent according to the sequence numbers, and received */
+	uint16_t expected;
+	uint16_t received;
+	/* Heartbeats dropped by the sequence window */
+	uint16_t duplicates;
+	uint16_t stale;
+	/* Smoothed deviation of the arrivals from the publish period, in ms */
+	uint16_t jitter;
+	/* Publish period announced by the sender, in seconds */
+	uint8_t period;
+	uint32_t last_rx;
+	/* Saturating histograms, halved when a bucket is full */
+	uint8_t hops[LINK_HOP_BUCKETS];
+	uint8_t rssi[LINK_RSSI_BINS];
+};
+
+void link_quality_update(struct link_quality *lq, uint16_t seq, uint8_t hops,
+			 int8_t rssi, uint32_t now, uint8_t period);
+void link_quality_reject(struct link_quality *lq, bool stale);
+
+/* Lost heartbeats in per mille, counting the ones overdue right now */
+uint16_t link_quality_loss(const struct link_quality *lq, uint32_t now);
+int8_t link_quality_rssi_percentile(const struct link_quality *lq,
+				    uint8_t percent);
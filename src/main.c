@@ -17,6 +17,9 @@
 
 #include "mesh.h"
 #include "board.h"
+#include "gateway.h"
+#include "bench.h"
+#include "sim.h"
 
 static const struct bt_data ad[] = {
 	BT_DATA_BYTES(BT_DATA_FLAGS, BT_LE_AD_NO_BREDR),
@@ -166,6 +169,10 @@ static void bt_ready(int err)
 
 	printk("Mesh initialized\n");
 
+	if (MESH_SIM) {
+		sim_init();
+	}
+
 	bt_conn_cb_register(&conn_cb);
 	bt_conn_auth_cb_register(&auth_cb);
 
@@ -173,7 +180,10 @@ static void bt_ready(int err)
 		settings_load();
 	}
 
-	if (!mesh_is_initialized()) {
+	if (!mesh_is_initialized() && MESH_AUTO_COMMISSION) {
+		/* Pick an address and join without the phone app */
+		mesh_start();
+	} else if (!mesh_is_initialized()) {
 		/* Start advertising */
 		err = bt_le_adv_start(BT_LE_ADV_CONN_NAME,
 				      ad, ARRAY_SIZE(ad), NULL, 0);
@@ -183,6 +193,8 @@ static void bt_ready(int err)
 		}
 	} else {
 		printk("Already provisioned\n");
+		/* Finish probing if the board restarted in the middle of it */
+		mesh_start();
 	}
 
 	board_refresh_display();
@@ -202,6 +214,16 @@ void main(void)
 
 	printk("Starting Board Demo\n");
 
+	if (MESH_BENCH) {
+		bench_run();
+		return;
+	}
+
+	err = gateway_init();
+	if (err) {
+		printk("gateway init failed (err %d)\n", err);
+	}
+
 	/* Initialize the Bluetooth Subsystem */
 	err = bt_enable(bt_ready);
 	if (err) {
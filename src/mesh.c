@@ -3,6 +3,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <sys/printk.h>
+#include <random/rand32.h>
 
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/mesh.h>
@@ -13,56 +14,128 @@
 #include "mesh.h"
 #include "board.h"
 #include "mesh_app.h"
+#include "sensor_cadence.h"
+#include "commission.h"
+#include "aggregate.h"
+#include "ttl_ctl.h"
+#include "relay_ctl.h"
+#include "seq_window.h"
+#include "friendship.h"
+#include "power.h"
+#include "energy.h"
+#include "trace.h"
+#include "diag.h"
+#include "tune.h"
+#include "uplink.h"
 
 // ======================================== CONST Configurations ======================================== //
 
 #define MOD_LF            0x0000
+#define OP_PROBE          0xb0
+#define OP_CONFLICT       0xb1
+#define OP_AGG_BEACON     0xb2
+#define OP_AGG_REPORT     0xb3
+#define OP_ENERGY_GET     0xb4
+#define OP_ENERGY_STATUS  0xb5
+#define OP_TIME_BEACON    0xb6
+#define OP_STATS_GET      0xb7
+#define OP_STATS_STATUS   0xb8
 #define OP_CALIBRATION          0xbb
 #define OP_HEARTBEAT      0xbc
 #define OP_BADUSER        0xbd
 #define OP_VND_CALIBRATION      BT_MESH_MODEL_OP_3(OP_CALIBRATION, BT_COMP_ID_LF)
 #define OP_VND_HEARTBEAT  BT_MESH_MODEL_OP_3(OP_HEARTBEAT, BT_COMP_ID_LF)
 #define OP_VND_BADUSER    BT_MESH_MODEL_OP_3(OP_BADUSER, BT_COMP_ID_LF)
+#define OP_VND_PROBE      BT_MESH_MODEL_OP_3(OP_PROBE, BT_COMP_ID_LF)
+#define OP_VND_CONFLICT   BT_MESH_MODEL_OP_3(OP_CONFLICT, BT_COMP_ID_LF)
+#define OP_VND_AGG_BEACON BT_MESH_MODEL_OP_3(OP_AGG_BEACON, BT_COMP_ID_LF)
+#define OP_VND_AGG_REPORT BT_MESH_MODEL_OP_3(OP_AGG_REPORT, BT_COMP_ID_LF)
+#define OP_VND_ENERGY_GET BT_MESH_MODEL_OP_3(OP_ENERGY_GET, BT_COMP_ID_LF)
+#define OP_VND_ENERGY_STATUS BT_MESH_MODEL_OP_3(OP_ENERGY_STATUS, BT_COMP_ID_LF)
+#define OP_VND_TIME_BEACON BT_MESH_MODEL_OP_3(OP_TIME_BEACON, BT_COMP_ID_LF)
+#define OP_VND_STATS_GET  BT_MESH_MODEL_OP_3(OP_STATS_GET, BT_COMP_ID_LF)
+#define OP_VND_STATS_STATUS BT_MESH_MODEL_OP_3(OP_STATS_STATUS, BT_COMP_ID_LF)
 
 #define IV_INDEX          0
-#define DEFAULT_TTL       31
+#define DEFAULT_TTL       MESH_TTL_MAX
 #define GROUP_ADDR        0xc123
 #define NET_IDX           0x000
 #define APP_IDX           0x000
 #define FLAGS             0
 
-#define TTL_SIZE 1
-#define NAME_SIZE         8
+#define ADDR_SIZE 2
+#define AGG_BEACON_SIZE (ADDR_SIZE + 1 + ADDR_SIZE)
+#define AGG_REPORT_HDR_SIZE (1 + 2 + 2 + 4 + 1)
+#define AGG_EDGE_SIZE (ADDR_SIZE + ADDR_SIZE + 1)
+#define ENERGY_STATUS_SIZE (5 * 4 + ENERGY_EVENT_COUNT * (4 + 4))
+#define ENERGY_REPLY_DELAY_RANDOM_MS 2000
+#define ENERGY_REPLY_MAX 4
+#define TIME_BEACON_SIZE (ADDR_SIZE + 1 + 4)
+#define STATS_STATUS_SIZE (1 + DIAG_PAGE_SIZE)
 #define PROXIMITY_SIZE 4
 #define TEMPERATURE_SIZE 4
 
-#define VALID_PROXIMITY_DELTA 10
-
-#define MAX_SENS_STATUS_LEN 8
-
-#define SENS_PROP_ID_PRESENT_DEVICE_TEMP 0x0054
-
-enum 
-{
-	SENSOR_HDR_A = 0,
-	SENSOR_HDR_B = 1,
-};
-
-struct sensor_hdr_a {
-	uint16_t prop_id:11;
-	uint16_t length:4;
-	uint16_t format:1;
-} __packed;
-
-struct sensor_hdr_b {
-	uint8_t length:7;
-	uint8_t format:1;
-	uint16_t prop_id;
-} __packed;
+#define MAX_SENS_STATUS_LEN (SENS_PROP_COUNT * (2 + 2))
+
+#define SENSOR_HDR_A 0
+#define SENSOR_HDR_B 1
+
+// Segments of 12 octets, the last ones carry the 4 octet TransMIC. The
+// largest heartbeat takes HEARTBEAT_SEGS of them, see mesh.h
+#define SEG_SIZE 12
+#define TRANS_MIC_SIZE 4
+
+BUILD_ASSERT(HEARTBEAT_SEGS <= CONFIG_BT_MESH_TX_SEG_MAX,
+	     "Largest heartbeat needs more than BT_MESH_TX_SEG_MAX segments");
+BUILD_ASSERT(HEARTBEAT_SEGS <= CONFIG_BT_MESH_RX_SEG_MAX,
+	     "Largest heartbeat needs more than BT_MESH_RX_SEG_MAX segments");
+// Every segmented message slot may hold a heartbeat at the same time
+BUILD_ASSERT(HEARTBEAT_SEGS * (CONFIG_BT_MESH_TX_SEG_MSG_COUNT +
+			       CONFIG_BT_MESH_RX_SEG_MSG_COUNT) <=
+	     CONFIG_BT_MESH_SEG_BUFS,
+	     "BT_MESH_SEG_BUFS can't hold a heartbeat in every message slot");
+
+// Largest aggregate report, 257 octets in 22 segments with the defaults
+#define AGG_REPORT_MSG_SIZE (3 + AGG_REPORT_HDR_SIZE + \
+	AGGREGATE_EDGES_MAX * AGG_EDGE_SIZE + TRANS_MIC_SIZE)
+#define AGG_REPORT_SEGS ceiling_fraction(AGG_REPORT_MSG_SIZE, SEG_SIZE)
+
+BUILD_ASSERT(AGG_REPORT_SEGS <= CONFIG_BT_MESH_TX_SEG_MAX,
+	     "Largest aggregate report needs more than BT_MESH_TX_SEG_MAX segments");
+BUILD_ASSERT(AGG_REPORT_SEGS <= CONFIG_BT_MESH_RX_SEG_MAX,
+	     "Largest aggregate report needs more than BT_MESH_RX_SEG_MAX segments");
+
+// Stack the host and the mesh need below our handlers and work items, the
+// default BT_RX_STACK_SIZE of mesh builds. Our buffers come on top of it.
+#define MESH_STACK_MARGIN 2048
+
+// vnd_heartbeat() copies the message, update_node_data() then builds the
+// gateway record below it
+BUILD_ASSERT(MESH_STACK_MARGIN + MAX_MESSAGE_SIZE + UPLINK_RECORD_MAX <=
+	     CONFIG_BT_RX_STACK_SIZE,
+	     "Heartbeat copy and gateway record don't fit the BT RX stack");
+// The aggregate report in mesh_send_report(), or the gateway record of
+// get_self_node_message() when the heartbeat is published
+BUILD_ASSERT(MESH_STACK_MARGIN + MAX(AGG_REPORT_MSG_SIZE, UPLINK_RECORD_MAX) <=
+	     CONFIG_SYSTEM_WORKQUEUE_STACK_SIZE,
+	     "Aggregate report doesn't fit the system work queue stack");
 
 static struct k_work calibration_work;
 static struct k_work baduser_work;
 static struct k_work mesh_start_work;
+static struct k_delayed_work energy_reply_work;
+static struct k_work energy_get_work;
+
+// Sequence number of the next heartbeat. It starts from a random value, a
+// restart from 0 would land in the windows receivers still hold and be
+// dropped as duplicates.
+static uint16_t heartbeat_seq;
+
+// Nodes that asked for the energy report in the current reply window, each
+// one gets a status of its own
+static uint16_t energy_reply_addrs[ENERGY_REPLY_MAX];
+static uint8_t energy_reply_count;
+static struct k_spinlock energy_reply_lock;
 
 /* Definitions of models user data (Start) */
 static struct led_onoff_state led_onoff_state[] = {
@@ -78,7 +151,35 @@ const char* get_bluetooth_name()
 void copy_bluetooth_name(char *buffer)
 {
 	const char* bluetooth_name = get_bluetooth_name();
-	strcpy(self_node_data.name, bluetooth_name);
+	strncpy(self_node_data.name, bluetooth_name, NAME_SIZE - 1);
+	self_node_data.name[NAME_SIZE - 1] = '\0';
+}
+
+// Sends through the access layer and accounts for the radio time
+static int model_send(struct bt_mesh_model *model,
+		      struct bt_mesh_msg_ctx *ctx,
+		      struct net_buf_simple *msg)
+{
+	int err = bt_mesh_model_send(model, ctx, msg, NULL, NULL);
+
+	if (!err)
+	{
+		energy_tx(msg->len);
+	}
+
+	return err;
+}
+
+// The stack relays a group message it delivers here as long as the relay is
+// on and the TTL allows another hop. That's all of the relaying the app gets
+// to see, the messages for groups it isn't subscribed to aren't counted.
+static void relay_account(struct bt_mesh_msg_ctx *ctx)
+{
+	if (IS_ENABLED(CONFIG_BT_MESH_RELAY) && relay_ctl_is_relay() &&
+	    ctx->recv_dst == GROUP_ADDR && ctx->recv_ttl > 1)
+	{
+		energy_count(ENERGY_RELAY);
+	}
 }
 
 static struct bt_mesh_cfg_cli cfg_cli = { };
@@ -115,7 +216,7 @@ static void gen_onoff_get(struct bt_mesh_model *model,
 	bt_mesh_model_msg_init(&msg, BT_MESH_MODEL_OP_GEN_ONOFF_STATUS);
 	net_buf_simple_add_u8(&msg, state->current);
 
-	if (bt_mesh_model_send(model, ctx, &msg, NULL, NULL)) {
+	if (model_send(model, ctx, &msg)) {
 		printk("Unable to send On Off Status response\n");
 	}
 }
@@ -179,6 +280,8 @@ static void gen_onoff_set_unack(struct bt_mesh_model *model,
 		err = bt_mesh_model_publish(model);
 		if (err) {
 			printk("bt_mesh_model_publish err %d\n", err);
+		} else {
+			energy_tx(msg->len);
 		}
 	}
 }
@@ -198,28 +301,17 @@ static void sensor_desc_get(struct bt_mesh_model *model,
 	/* TODO */
 }
 
-static void sens_temperature_celsius_fill(struct net_buf_simple *msg)
+static void sens_value_fill(const struct sensor_prop *prop,
+			    struct net_buf_simple *msg)
 {
-	struct sensor_hdr_a hdr;
-	/* TODO Get only temperature from sensor */
-	struct sensor_value val[2];
-	int16_t temp_degrees;
-
-	hdr.format = SENSOR_HDR_A;
-	hdr.length = sizeof(temp_degrees);
-	hdr.prop_id = SENS_PROP_ID_PRESENT_DEVICE_TEMP;
-
-	get_hdc1010_val(val);
-	temp_degrees = sensor_value_to_double(&val[0]) * 100;
-	printf("The temperture value :%d",temp_degrees);
-	net_buf_simple_add_mem(msg, &hdr, sizeof(hdr));
-	net_buf_simple_add_le16(msg, temp_degrees);
+	/* Marshalled Property ID, format A: Length is zero based */
+	net_buf_simple_add_le16(msg, SENSOR_HDR_A | ((prop->size - 1) << 1) |
+				(prop->id << 5));
+	net_buf_simple_add_le16(msg, prop->value);
 }
 
 static void sens_unknown_fill(uint16_t id, struct net_buf_simple *msg)
 {
-	struct sensor_hdr_b hdr;
-
 	/*
 	 * When the message is a response to a Sensor Get message that
 	 * identifies a sensor property that does not exist on the element, the
@@ -229,24 +321,20 @@ static void sens_unknown_fill(uint16_t id, struct net_buf_simple *msg)
 	 * The length zero is represented using the format B and the special
 	 * value 0x7F.
 	 */
-	hdr.format = SENSOR_HDR_B;
-	hdr.length = 0x7FU;
-	hdr.prop_id = id;
-
-	net_buf_simple_add_mem(msg, &hdr, sizeof(hdr));
+	net_buf_simple_add_u8(msg, SENSOR_HDR_B | (0x7f << 1));
+	net_buf_simple_add_le16(msg, id);
 }
 
 static void sensor_create_status(uint16_t id, struct net_buf_simple *msg)
 {
+	struct sensor_prop *prop = sensor_prop_find(id);
+
 	bt_mesh_model_msg_init(msg, BT_MESH_MODEL_OP_SENS_STATUS);
 
-	switch (id) {
-	case SENS_PROP_ID_PRESENT_DEVICE_TEMP:
-		sens_temperature_celsius_fill(msg);
-		break;
-	default:
+	if (prop) {
+		sens_value_fill(prop, msg);
+	} else {
 		sens_unknown_fill(id, msg);
-		break;
 	}
 }
 
@@ -255,12 +343,22 @@ static void sensor_get(struct bt_mesh_model *model,
 		       struct net_buf_simple *buf)
 {
 	NET_BUF_SIMPLE_DEFINE(msg, 1 + MAX_SENS_STATUS_LEN + 4);
-	uint16_t sensor_id;
+	int i;
+
 	printk("Senor_get function\n");
-	sensor_id = net_buf_simple_pull_le16(buf);
-	sensor_create_status(sensor_id, &msg);
 
-	if (bt_mesh_model_send(model, ctx, &msg, NULL, NULL)) {
+	if (buf->len >= 2) {
+		sensor_create_status(net_buf_simple_pull_le16(buf), &msg);
+	} else {
+		/* No Property ID: report every sensor */
+		bt_mesh_model_msg_init(&msg, BT_MESH_MODEL_OP_SENS_STATUS);
+
+		for (i = 0; i < ARRAY_SIZE(sensor_props); i++) {
+			sens_value_fill(&sensor_props[i], &msg);
+		}
+	}
+
+	if (model_send(model, ctx, &msg)) {
 		printk("Unable to send Sensor get status response\n");
 	}
 }
@@ -279,25 +377,198 @@ static void sensor_series_get(struct bt_mesh_model *model,
 	/* TODO */
 }
 
+/* Publish Period state (Mesh Profile 4.2.2.2) to milliseconds */
+static int32_t pub_period_ms(uint8_t period)
+{
+	static const int32_t resolution[] = { 100, MSEC_PER_SEC,
+					      10 * MSEC_PER_SEC,
+					      10 * 60 * MSEC_PER_SEC };
+
+	return (period & BIT_MASK(6)) * resolution[period >> 6];
+}
+
 static int sensor_pub_update(struct bt_mesh_model *mod)
 {
 	struct net_buf_simple *msg = mod->pub->msg;
+	int64_t now = k_uptime_get();
+	int i;
 
-	// printk("Preparing to send heartbeat\n");
+	bt_mesh_model_msg_init(msg, BT_MESH_MODEL_OP_SENS_STATUS);
 
-	bt_mesh_model_msg_init(msg, BT_MESH_MODEL_OP_SENS_GET);
-	
-	net_buf_simple_add_u8(msg, DEFAULT_TTL);
+	for (i = 0; i < ARRAY_SIZE(sensor_props); i++) {
+		sens_value_fill(&sensor_props[i], msg);
+		sensor_prop_published(&sensor_props[i], now);
+	}
+
+	/* Fast Cadence: divide the period while a value is in its range */
+	mod->pub->period_div = sensor_fast_period_div(
+		pub_period_ms(mod->pub->period));
+	mod->pub->fast_period = mod->pub->period_div != 0U;
+
+	energy_tx(msg->len);
+
+	return 0;
+}
+
+/* Sensor Setup Server message handlers */
+static void sensor_cadence_status(struct bt_mesh_model *model,
+				  struct bt_mesh_msg_ctx *ctx, uint16_t id)
+{
+	NET_BUF_SIMPLE_DEFINE(msg, 1 + 2 + 1 + 4 * 2 + 1 + 4);
+	struct sensor_prop *prop = sensor_prop_find(id);
+
+	bt_mesh_model_msg_init(&msg, BT_MESH_MODEL_OP_SENS_CADENCE_STATUS);
+
+	if (prop) {
+		sensor_cadence_add(prop, &msg);
+	} else {
+		net_buf_simple_add_le16(&msg, id);
+	}
+
+	if (model_send(model, ctx, &msg)) {
+		printk("Unable to send Sensor Cadence status\n");
+	}
+}
+
+static void sensor_cadence_get(struct bt_mesh_model *model,
+			       struct bt_mesh_msg_ctx *ctx,
+			       struct net_buf_simple *buf)
+{
+	sensor_cadence_status(model, ctx, net_buf_simple_pull_le16(buf));
+}
+
+static int sensor_cadence_update(uint16_t id, struct net_buf_simple *buf)
+{
+	struct sensor_prop *prop = sensor_prop_find(id);
+
+	if (!prop) {
+		return -ENOENT;
+	}
+
+	if (sensor_cadence_pull(prop, buf)) {
+		printk("Invalid cadence for property 0x%04x\n", id);
+		return -EINVAL;
+	}
 
-	net_buf_simple_add_u8(msg, DEFAULT_TTL);
+	printk("Cadence of 0x%04x: div %u delta -%d/+%d interval %u\n", id,
+	       prop->cadence.fast_period_div, prop->cadence.delta_down,
+	       prop->cadence.delta_up, prop->cadence.min_interval);
 
 	return 0;
 }
 
+static void sensor_cadence_set_unack(struct bt_mesh_model *model,
+				     struct bt_mesh_msg_ctx *ctx,
+				     struct net_buf_simple *buf)
+{
+	sensor_cadence_update(net_buf_simple_pull_le16(buf), buf);
+}
+
+static void sensor_cadence_set(struct bt_mesh_model *model,
+			       struct bt_mesh_msg_ctx *ctx,
+			       struct net_buf_simple *buf)
+{
+	uint16_t id = net_buf_simple_pull_le16(buf);
+
+	/* Invalid messages are ignored, unknown properties still answered */
+	if (sensor_cadence_update(id, buf) != -EINVAL) {
+		sensor_cadence_status(model, ctx, id);
+	}
+}
+
+static void sensor_settings_get(struct bt_mesh_model *model,
+				struct bt_mesh_msg_ctx *ctx,
+				struct net_buf_simple *buf)
+{
+	NET_BUF_SIMPLE_DEFINE(msg, 1 + 2 + 2 + 4);
+	uint16_t id = net_buf_simple_pull_le16(buf);
+	struct sensor_prop *prop = sensor_prop_find(id);
+
+	bt_mesh_model_msg_init(&msg, BT_MESH_MODEL_OP_SENS_SETTINGS_STATUS);
+	net_buf_simple_add_le16(&msg, id);
+
+	if (prop) {
+		net_buf_simple_add_le16(&msg, prop->setting.prop_id);
+	}
+
+	if (model_send(model, ctx, &msg)) {
+		printk("Unable to send Sensor Settings status\n");
+	}
+}
+
+static void sensor_setting_status(struct bt_mesh_model *model,
+				  struct bt_mesh_msg_ctx *ctx, uint16_t id,
+				  uint16_t setting_id)
+{
+	NET_BUF_SIMPLE_DEFINE(msg, 1 + 2 + 2 + 1 + 2 + 4);
+	struct sensor_prop *prop = sensor_prop_find(id);
+
+	bt_mesh_model_msg_init(&msg, BT_MESH_MODEL_OP_SENS_SETTING_STATUS);
+	net_buf_simple_add_le16(&msg, id);
+	net_buf_simple_add_le16(&msg, setting_id);
+
+	if (prop && prop->setting.prop_id == setting_id) {
+		net_buf_simple_add_u8(&msg, prop->setting.access);
+		net_buf_simple_add_le16(&msg, prop->setting.value);
+	}
+
+	if (model_send(model, ctx, &msg)) {
+		printk("Unable to send Sensor Setting status\n");
+	}
+}
+
+static void sensor_setting_get(struct bt_mesh_model *model,
+			       struct bt_mesh_msg_ctx *ctx,
+			       struct net_buf_simple *buf)
+{
+	uint16_t id = net_buf_simple_pull_le16(buf);
+	uint16_t setting_id = net_buf_simple_pull_le16(buf);
+
+	sensor_setting_status(model, ctx, id, setting_id);
+}
+
+static void sensor_setting_update(uint16_t id, uint16_t setting_id,
+				  struct net_buf_simple *buf)
+{
+	struct sensor_prop *prop = sensor_prop_find(id);
+
+	if (!prop || prop->setting.prop_id != setting_id || buf->len != 2 ||
+	    prop->setting.access != SENS_SETTING_ACCESS_READ_WRITE) {
+		return;
+	}
+
+	prop->setting.value = net_buf_simple_pull_le16(buf);
+
+	printk("Setting 0x%04x of 0x%04x set to %d\n", setting_id, id,
+	       prop->setting.value);
+}
+
+static void sensor_setting_set_unack(struct bt_mesh_model *model,
+				     struct bt_mesh_msg_ctx *ctx,
+				     struct net_buf_simple *buf)
+{
+	uint16_t id = net_buf_simple_pull_le16(buf);
+	uint16_t setting_id = net_buf_simple_pull_le16(buf);
+
+	sensor_setting_update(id, setting_id, buf);
+}
+
+static void sensor_setting_set(struct bt_mesh_model *model,
+			       struct bt_mesh_msg_ctx *ctx,
+			       struct net_buf_simple *buf)
+{
+	uint16_t id = net_buf_simple_pull_le16(buf);
+	uint16_t setting_id = net_buf_simple_pull_le16(buf);
+
+	sensor_setting_update(id, setting_id, buf);
+	sensor_setting_status(model, ctx, id, setting_id);
+}
+
 /* Definitions of models publication context (Start) */
 BT_MESH_HEALTH_PUB_DEFINE(health_pub, 0);
 BT_MESH_MODEL_PUB_DEFINE(gen_onoff_srv_pub_root, NULL, 2 + 3);
-BT_MESH_MODEL_PUB_DEFINE(sensor_srv_pub, sensor_pub_update, 3 + 1);
+BT_MESH_MODEL_PUB_DEFINE(sensor_srv_pub, sensor_pub_update,
+			 1 + MAX_SENS_STATUS_LEN + 4);
 /* Mapping of message handlers for Generic OnOff Server (0x1000) */
 static const struct bt_mesh_model_op gen_onoff_srv_op[] = {
 	{ BT_MESH_MODEL_OP_GEN_ONOFF_GET, 0, gen_onoff_get },
@@ -309,9 +580,24 @@ static const struct bt_mesh_model_op gen_onoff_srv_op[] = {
 /* Mapping of message handlers for Sensor Server (0x1100) */
 static const struct bt_mesh_model_op sensor_srv_op[] = {
 	{ BT_MESH_MODEL_OP_SENS_DESC_GET, 0, sensor_desc_get },
-	{ BT_MESH_MODEL_OP_SENS_GET, 1, sensor_get },
+	{ BT_MESH_MODEL_OP_SENS_GET, 0, sensor_get },
 	{ BT_MESH_MODEL_OP_SENS_COL_GET, 2, sensor_col_get },
 	{ BT_MESH_MODEL_OP_SENS_SERIES_GET, 2, sensor_series_get },
+	BT_MESH_MODEL_OP_END,
+};
+
+/* Mapping of message handlers for Sensor Setup Server (0x1101) */
+static const struct bt_mesh_model_op sensor_setup_srv_op[] = {
+	{ BT_MESH_MODEL_OP_SENS_CADENCE_GET, 2, sensor_cadence_get },
+	{ BT_MESH_MODEL_OP_SENS_CADENCE_SET, 4, sensor_cadence_set },
+	{ BT_MESH_MODEL_OP_SENS_CADENCE_SET_UNACK, 4,
+	  sensor_cadence_set_unack },
+	{ BT_MESH_MODEL_OP_SENS_SETTINGS_GET, 2, sensor_settings_get },
+	{ BT_MESH_MODEL_OP_SENS_SETTING_GET, 4, sensor_setting_get },
+	{ BT_MESH_MODEL_OP_SENS_SETTING_SET, 4, sensor_setting_set },
+	{ BT_MESH_MODEL_OP_SENS_SETTING_SET_UNACK, 4,
+	  sensor_setting_set_unack },
+	BT_MESH_MODEL_OP_END,
 };
 
 static struct bt_mesh_model root_models[] = 
@@ -323,11 +609,53 @@ static struct bt_mesh_model root_models[] =
 		      &led_onoff_state[0]),
 	BT_MESH_MODEL(BT_MESH_MODEL_ID_SENSOR_SRV,
 		      sensor_srv_op, &sensor_srv_pub, NULL),
+	BT_MESH_MODEL(BT_MESH_MODEL_ID_SENSOR_SETUP_SRV,
+		      sensor_setup_srv_op, NULL, NULL),
 };
 
+#define SENSOR_SRV_MODEL (&root_models[3])
+
+/*
+ * Called with every new sample. Publishes ahead of the periodic Sensor Status
+ * when a reading moved past its Status Trigger Delta, once the Status Min
+ * Interval since the last status allows it.
+ */
+void mesh_sensor_update(int32_t temperature, int32_t humidity)
+{
+	struct bt_mesh_model *mod = SENSOR_SRV_MODEL;
+	int64_t now = k_uptime_get();
+	bool triggered = false;
+	int err, i;
+
+	sensor_props_sample(temperature, humidity);
+
+	if (!mesh_is_initialized() ||
+	    mod->pub->addr == BT_MESH_ADDR_UNASSIGNED) {
+		return;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(sensor_props); i++) {
+		if (sensor_prop_delta_triggered(&sensor_props[i]) &&
+		    sensor_prop_min_interval_elapsed(&sensor_props[i], now)) {
+			triggered = true;
+		}
+	}
+
+	if (!triggered) {
+		return;
+	}
+
+	sensor_pub_update(mod);
+
+	err = bt_mesh_model_publish(mod);
+	if (err) {
+		printk("Sensor status publish failed (err %d)\n", err);
+	}
+}
+
 int is_in_vicinity(int other_node_proximity)
 {
-	if (abs(other_node_proximity - self_node_data.proximity) < VALID_PROXIMITY_DELTA)
+	if (abs(other_node_proximity - self_proximity) < tune.proximity_delta)
 		return 1;
 
 	return 0;
@@ -344,12 +672,14 @@ static void vnd_calibration(struct bt_mesh_model *model,
 		return;
 	}
 
+	relay_account(ctx);
+
 	// Fetch proximity
 	int received_proximity;
 	memcpy(&received_proximity, buf->data, PROXIMITY_SIZE);
 
 	// Fetch name
-	char received_name[32];
+	char received_name[NAME_SIZE + 1];
 	size_t len = MIN(buf->len - PROXIMITY_SIZE, NAME_SIZE);
 
 	memcpy(received_name, buf->data + PROXIMITY_SIZE, len);
@@ -387,7 +717,7 @@ static void vnd_baduser(struct bt_mesh_model *model,
 			struct bt_mesh_msg_ctx *ctx,
 			struct net_buf_simple *buf)
 {
-	char str[32];
+	char str[NAME_SIZE + sizeof(" is misbehaving!")];
 	size_t len;
 
 	printk("\"Bad user\" message from 0x%04x\n", ctx->addr);
@@ -397,6 +727,8 @@ static void vnd_baduser(struct bt_mesh_model *model,
 		return;
 	}
 
+	relay_account(ctx);
+
 	len = MIN(buf->len, NAME_SIZE);
 	memcpy(str, buf->data, len);
 	str[len] = '\0';
@@ -412,7 +744,8 @@ static void vnd_heartbeat(struct bt_mesh_model *model,
 			struct bt_mesh_msg_ctx *ctx,
 			struct net_buf_simple *buf)
 {
-	uint8_t init_ttl, hops;
+	uint8_t init_ttl, hops, period;
+	uint16_t seq, stamp = 0U;
 
 	if (ctx->addr == bt_mesh_model_elem(model)->addr) 
 	{
@@ -422,30 +755,294 @@ static void vnd_heartbeat(struct bt_mesh_model *model,
 		return;
 	}
 
+	friendship_rx(MESH_PDUS(3 + buf->len));
+	relay_account(ctx);
+
 	init_ttl = net_buf_simple_pull_u8(buf);
 	hops = init_ttl - ctx->recv_ttl + 1;
+	seq = net_buf_simple_pull_le16(buf);
+	period = net_buf_simple_pull_u8(buf);
+
+	if (MESH_TRACE)
+	{
+		stamp = net_buf_simple_pull_le16(buf);
+	}
+
+	// Drop echoes through other relays before spending any time on them
+	switch (seq_window_check(ctx->addr, seq))
+	{
+	case SEQ_DUPLICATE:
+		board_reject_heartbeat(ctx->addr, false);
+		return;
+	case SEQ_STALE:
+		board_reject_heartbeat(ctx->addr, true);
+		return;
+	default:
+		break;
+	}
 
 	// printk("Heartbeat from 0x%04x rssi %d size %d over %u hop%s.\n", 
 	// 	ctx->addr, ctx->recv_rssi, buf->len, hops, hops == 1U ? "" : "s");
 
 	char message[MAX_MESSAGE_SIZE];
+	size_t len = MIN(buf->len, MAX_MESSAGE_SIZE - 1);
 
-	memcpy(message, buf->data, buf->len);
-	message[(buf->len - TTL_SIZE) + 1] = '\0';
+	memcpy(message, buf->data, len);
+	message[len] = '\0';
 
 	// printf("Received message: '%s'\n", message);
 
 	update_node_data(ctx->addr, ctx->recv_rssi, message);
 
-	board_add_heartbeat(ctx->addr, hops);
+	board_add_heartbeat(ctx->addr, hops, seq, ctx->recv_rssi, period);
+
+	if (MESH_TRACE)
+	{
+		trace_heartbeat(ctx->addr, hops, stamp);
+	}
+
+	ttl_ctl_observe(hops);
+	relay_ctl_observe(ctx->addr, hops, ctx->recv_rssi);
+	power_neighbor_rx();
+}
+
+// Address probe handler
+static void vnd_probe(struct bt_mesh_model *model,
+			struct bt_mesh_msg_ctx *ctx,
+			struct net_buf_simple *buf)
+{
+	uint16_t addr = net_buf_simple_pull_le16(buf);
+
+	relay_account(ctx);
+	commission_probe_recv(addr, buf->data);
+}
+
+// Address conflict handler
+static void vnd_conflict(struct bt_mesh_model *model,
+			struct bt_mesh_msg_ctx *ctx,
+			struct net_buf_simple *buf)
+{
+	uint16_t addr = net_buf_simple_pull_le16(buf);
+
+	printk("Conflict on 0x%04x reported by 0x%04x\n", addr, ctx->addr);
+
+	relay_account(ctx);
+
+	commission_conflict_recv(addr, buf->data);
+}
+
+// Aggregation beacon handler, only heard from direct neighbors
+static void vnd_agg_beacon(struct bt_mesh_model *model,
+			struct bt_mesh_msg_ctx *ctx,
+			struct net_buf_simple *buf)
+{
+	uint16_t sink, parent;
+	uint8_t depth;
+
+	if (ctx->addr == bt_mesh_model_elem(model)->addr)
+	{
+		return;
+	}
+
+	sink = net_buf_simple_pull_le16(buf);
+	depth = net_buf_simple_pull_u8(buf);
+	parent = net_buf_simple_pull_le16(buf);
+
+	aggregate_beacon_recv(ctx->addr, sink, depth, parent, ctx->recv_rssi);
+}
+
+// Aggregation report handler, sent by the children of this node
+static void vnd_agg_report(struct bt_mesh_model *model,
+			struct bt_mesh_msg_ctx *ctx,
+			struct net_buf_simple *buf)
+{
+	static struct aggregate_report report;
+	int i;
+
+	report.nodes = net_buf_simple_pull_u8(buf);
+	report.temp_min = net_buf_simple_pull_le16(buf);
+	report.temp_max = net_buf_simple_pull_le16(buf);
+	report.temp_sum = net_buf_simple_pull_le32(buf);
+	report.edge_count = net_buf_simple_pull_u8(buf);
+
+	if (report.edge_count > AGGREGATE_EDGES_MAX ||
+	    buf->len < report.edge_count * AGG_EDGE_SIZE)
+	{
+		printk("Malformed report from 0x%04x\n", ctx->addr);
+		return;
+	}
+
+	for (i = 0; i < report.edge_count; i++)
+	{
+		report.edges[i].a = net_buf_simple_pull_le16(buf);
+		report.edges[i].b = net_buf_simple_pull_le16(buf);
+		report.edges[i].distance = net_buf_simple_pull_u8(buf);
+	}
+
+	aggregate_report_recv(ctx->addr, &report);
+}
+
+// Energy report request, answered after a random delay since it usually
+// goes to the whole group
+static void vnd_energy_get(struct bt_mesh_model *model,
+			struct bt_mesh_msg_ctx *ctx,
+			struct net_buf_simple *buf)
+{
+	k_spinlock_key_t key;
+	uint16_t delay;
+	bool first;
+	int i;
+
+	// The get goes to the group, our own comes back too
+	if (ctx->addr == bt_mesh_model_elem(model)->addr)
+	{
+		return;
+	}
+
+	relay_account(ctx);
+
+	key = k_spin_lock(&energy_reply_lock);
+
+	for (i = 0; i < energy_reply_count; i++)
+	{
+		if (energy_reply_addrs[i] == ctx->addr)
+		{
+			break;
+		}
+	}
+
+	first = !energy_reply_count;
+
+	if (i == energy_reply_count && i < ENERGY_REPLY_MAX)
+	{
+		energy_reply_addrs[energy_reply_count++] = ctx->addr;
+	}
+	else if (i == energy_reply_count)
+	{
+		printk("Energy get from 0x%04x dropped, %u waiting\n",
+		       ctx->addr, energy_reply_count);
+	}
+
+	k_spin_unlock(&energy_reply_lock, key);
+
+	// Later requesters join the reply already scheduled
+	if (!first)
+	{
+		return;
+	}
+
+	if (bt_rand(&delay, sizeof(delay)))
+	{
+		delay = 0U;
+	}
+
+	k_delayed_work_submit(&energy_reply_work,
+			      K_MSEC(delay % ENERGY_REPLY_DELAY_RANDOM_MS));
+}
+
+// Energy report of another node
+static void vnd_energy_status(struct bt_mesh_model *model,
+			struct bt_mesh_msg_ctx *ctx,
+			struct net_buf_simple *buf)
+{
+	uint32_t uptime, total, radio_rx, work, sleep;
+	int i;
+
+	uptime = net_buf_simple_pull_le32(buf);
+	total = net_buf_simple_pull_le32(buf);
+	radio_rx = net_buf_simple_pull_le32(buf);
+	work = net_buf_simple_pull_le32(buf);
+	sleep = net_buf_simple_pull_le32(buf);
+
+	printk("Energy of 0x%04x: %u.%03u mAh in %u s, radio rx %u.%03u,"
+	       " app work %u.%03u, sleep %u.%03u\n", ctx->addr,
+	       total / 1000U, total % 1000U, uptime, radio_rx / 1000U,
+	       radio_rx % 1000U, work / 1000U, work % 1000U, sleep / 1000U,
+	       sleep % 1000U);
+
+	for (i = 0; i < ENERGY_EVENT_COUNT; i++)
+	{
+		uint32_t count = net_buf_simple_pull_le32(buf);
+		uint32_t uah = net_buf_simple_pull_le32(buf);
+
+		printk("  %-11s %6u x %u.%03u mAh\n", energy_event_name(i),
+		       count, uah / 1000U, uah % 1000U);
+	}
+}
+
+// Time beacon handler, only heard from direct neighbors
+static void vnd_time_beacon(struct bt_mesh_model *model,
+			struct bt_mesh_msg_ctx *ctx,
+			struct net_buf_simple *buf)
+{
+	uint16_t master;
+	uint8_t stratum;
+	uint32_t time;
+
+	if (ctx->addr == bt_mesh_model_elem(model)->addr)
+	{
+		return;
+	}
+
+	master = net_buf_simple_pull_le16(buf);
+	stratum = net_buf_simple_pull_u8(buf);
+	time = net_buf_simple_pull_le32(buf);
+
+	trace_beacon_recv(master, stratum, time);
+}
+
+// Diagnostics page request, answered right away
+static void vnd_stats_get(struct bt_mesh_model *model,
+			struct bt_mesh_msg_ctx *ctx,
+			struct net_buf_simple *buf)
+{
+	NET_BUF_SIMPLE_DEFINE(msg, 3 + STATS_STATUS_SIZE + 4);
+	uint8_t page = net_buf_simple_pull_u8(buf);
+	uint8_t *data;
+
+	bt_mesh_model_msg_init(&msg, OP_VND_STATS_STATUS);
+	net_buf_simple_add_u8(&msg, page);
+	data = net_buf_simple_add(&msg, DIAG_PAGE_SIZE);
+
+	if (!diag_page(page, data))
+	{
+		return;
+	}
+
+	ctx->send_ttl = ttl_ctl_get();
+
+	if (model_send(model, ctx, &msg))
+	{
+		printk("Sending stats page %u to 0x%04x failed\n", page,
+		       ctx->addr);
+	}
+}
+
+// Diagnostics page of another node
+static void vnd_stats_status(struct bt_mesh_model *model,
+			struct bt_mesh_msg_ctx *ctx,
+			struct net_buf_simple *buf)
+{
+	uint8_t page = net_buf_simple_pull_u8(buf);
+
+	diag_status_recv(ctx->addr, page, buf->data, buf->len);
 }
 
 // Vendor model operations
 static const struct bt_mesh_model_op vnd_ops[] = 
 {
 	{ OP_VND_CALIBRATION, 1, vnd_calibration },
-	{ OP_VND_HEARTBEAT, 1, vnd_heartbeat },
+	{ OP_VND_HEARTBEAT, HEARTBEAT_HDR_SIZE, vnd_heartbeat },
 	{ OP_VND_BADUSER, 1, vnd_baduser },
+	{ OP_VND_PROBE, ADDR_SIZE + COMMISSION_ID_SIZE, vnd_probe },
+	{ OP_VND_CONFLICT, ADDR_SIZE + COMMISSION_ID_SIZE, vnd_conflict },
+	{ OP_VND_AGG_BEACON, AGG_BEACON_SIZE, vnd_agg_beacon },
+	{ OP_VND_AGG_REPORT, AGG_REPORT_HDR_SIZE, vnd_agg_report },
+	{ OP_VND_ENERGY_GET, 0, vnd_energy_get },
+	{ OP_VND_ENERGY_STATUS, ENERGY_STATUS_SIZE, vnd_energy_status },
+	{ OP_VND_TIME_BEACON, TIME_BEACON_SIZE, vnd_time_beacon },
+	{ OP_VND_STATS_GET, 1, vnd_stats_get },
+	{ OP_VND_STATS_STATUS, STATS_STATUS_SIZE, vnd_stats_status },
 	BT_MESH_MODEL_OP_END,
 };
 
@@ -453,12 +1050,27 @@ static const struct bt_mesh_model_op vnd_ops[] =
 static int vnd_pub_update(struct bt_mesh_model *mod)
 {
 	struct net_buf_simple *msg = mod->pub->msg;
+	uint32_t start = k_cycle_get_32();
 
 	// printk("Preparing to send vendor heartbeat\n");
 
 	bt_mesh_model_msg_init(msg, OP_VND_HEARTBEAT);
 	//bt_mesh_model_msg_init(msg, BT_MESH_MODEL_OP_SENS_GET);
-	net_buf_simple_add_u8(msg, DEFAULT_TTL);
+	net_buf_simple_add_u8(msg, mod->pub->ttl);
+
+	// Lets receivers count lost and repeated heartbeats
+	net_buf_simple_add_le16(msg, heartbeat_seq++);
+
+	// The period changes with the power level, receivers time the next one
+	// with it
+	net_buf_simple_add_u8(msg, pub_period_ms(mod->pub->period) /
+				   MSEC_PER_SEC);
+
+	// Send time on the mesh-wide clock, for the latency at the receivers
+	if (MESH_TRACE)
+	{
+		net_buf_simple_add_le16(msg, (uint16_t)trace_time());
+	}
 
 	char* message = (char*) malloc(MAX_MESSAGE_SIZE * sizeof(char));
 
@@ -474,13 +1086,17 @@ static int vnd_pub_update(struct bt_mesh_model *mod)
 
 		net_buf_simple_add_mem(msg, message, strlen(message));
 		free(message);
+
+		energy_tx(msg->len);
+		energy_work(start);
 		
 		return 0;
 	}
 }
 
 // Define publish model
-BT_MESH_MODEL_PUB_DEFINE(vnd_pub, vnd_pub_update, 3 + 1);
+BT_MESH_MODEL_PUB_DEFINE(vnd_pub, vnd_pub_update,
+			 3 + HEARTBEAT_HDR_SIZE + MAX_MESSAGE_SIZE + 4);
 
 // Element vendor models
 static struct bt_mesh_model vnd_models[] = 
@@ -520,9 +1136,9 @@ static size_t first_name_len(const char *name)
 
 static void send_calibration(struct k_work *work)
 {
-	printk("Attempting to send_calibration with %d proximity value.\n", self_node_data.proximity);
+	printk("Attempting to send_calibration with %d proximity value.\n", self_proximity);
 
-	if (is_valid_calibration(self_node_data.proximity))
+	if (is_valid_calibration(self_proximity))
 	{
 		NET_BUF_SIMPLE_DEFINE(msg, 3 + PROXIMITY_SIZE + NAME_SIZE + 4);
 
@@ -530,20 +1146,20 @@ static void send_calibration(struct k_work *work)
 		{
 			.app_idx = APP_IDX,
 			.addr = GROUP_ADDR,
-			.send_ttl = DEFAULT_TTL,
+			.send_ttl = ttl_ctl_get(),
 		};
 
 		// Initialize message
 		bt_mesh_model_msg_init(&msg, OP_VND_CALIBRATION);
 
 		// Add proximity data
-		net_buf_simple_add_mem(&msg, &self_node_data.proximity, PROXIMITY_SIZE);
+		net_buf_simple_add_mem(&msg, &self_proximity, PROXIMITY_SIZE);
 
 		// Add bluetooth name
 		const char* bluetooth_name = get_bluetooth_name();
 		net_buf_simple_add_mem(&msg, bluetooth_name, MIN(NAME_SIZE, first_name_len(bluetooth_name)));
 
-		if (bt_mesh_model_send(&vnd_models[0], &ctx, &msg, NULL, NULL) == 0) 
+		if (model_send(&vnd_models[0], &ctx, &msg) == 0) 
 		{
 			board_show_text("Sending calibration", false, K_SECONDS(1));
 		} 
@@ -556,11 +1172,11 @@ static void send_calibration(struct k_work *work)
 	{
 		// No board in the right vicinity found
 		printk("Bad proximity for calibration (p=%d). Proximity should be in the range (%d<p<%d) for calibration.\n", 
-			self_node_data.proximity, CALIBRATION_START_MIN, CALIBRATION_START_MAX);
+			self_proximity, CALIBRATION_START_MIN, CALIBRATION_START_MAX);
 
 		char str_buf[256];
 
-		snprintf(str_buf, sizeof(str_buf), "! prox=%d ! (%d<p<%d)", self_node_data.proximity,
+		snprintf(str_buf, sizeof(str_buf), "! prox=%d ! (%d<p<%d)", self_proximity,
 			CALIBRATION_START_MIN, CALIBRATION_START_MAX);
 
 		board_show_text(str_buf, false, K_SECONDS(1));
@@ -580,7 +1196,7 @@ static void send_baduser(struct k_work *work)
 	{
 		.app_idx = APP_IDX,
 		.addr = GROUP_ADDR,
-		.send_ttl = DEFAULT_TTL,
+		.send_ttl = ttl_ctl_get(),
 	};
 
 	const char* bluetooth_name = get_bluetooth_name();
@@ -588,7 +1204,7 @@ static void send_baduser(struct k_work *work)
 	bt_mesh_model_msg_init(&msg, OP_VND_BADUSER);
 	net_buf_simple_add_mem(&msg, bluetooth_name, MIN(NAME_SIZE, first_name_len(bluetooth_name)));
 
-	if (bt_mesh_model_send(&vnd_models[0], &ctx, &msg, NULL, NULL) == 0) 
+	if (model_send(&vnd_models[0], &ctx, &msg) == 0) 
 	{
 		board_show_text("Bad user!", false, K_SECONDS(2));
 	} 
@@ -603,7 +1219,215 @@ void mesh_send_baduser(void)
 	k_work_submit(&baduser_work);
 }
 
-static int provision_and_configure(void)
+static void send_energy_get(struct k_work *work)
+{
+	NET_BUF_SIMPLE_DEFINE(msg, 3 + 4);
+
+	struct bt_mesh_msg_ctx ctx = 
+	{
+		.app_idx = APP_IDX,
+		.addr = GROUP_ADDR,
+		.send_ttl = ttl_ctl_get(),
+	};
+
+	bt_mesh_model_msg_init(&msg, OP_VND_ENERGY_GET);
+
+	if (model_send(&vnd_models[0], &ctx, &msg))
+	{
+		printk("Sending energy request failed\n");
+	}
+}
+
+void mesh_send_energy_get(void)
+{
+	k_work_submit(&energy_get_work);
+}
+
+static void send_energy_status_to(uint16_t addr,
+				  const struct energy_report *report)
+{
+	NET_BUF_SIMPLE_DEFINE(msg, 3 + ENERGY_STATUS_SIZE + 4);
+
+	struct bt_mesh_msg_ctx ctx = 
+	{
+		.app_idx = APP_IDX,
+		.addr = addr,
+		.send_ttl = ttl_ctl_get(),
+	};
+
+	int i;
+
+	bt_mesh_model_msg_init(&msg, OP_VND_ENERGY_STATUS);
+	net_buf_simple_add_le32(&msg, report->uptime_ms / MSEC_PER_SEC);
+	net_buf_simple_add_le32(&msg, report->total_uah);
+	net_buf_simple_add_le32(&msg, report->radio_rx_uah);
+	net_buf_simple_add_le32(&msg, report->work_uah);
+	net_buf_simple_add_le32(&msg, report->sleep_uah);
+
+	for (i = 0; i < ENERGY_EVENT_COUNT; i++)
+	{
+		net_buf_simple_add_le32(&msg, report->events[i].count);
+		net_buf_simple_add_le32(&msg, report->event_uah[i]);
+	}
+
+	if (model_send(&vnd_models[0], &ctx, &msg))
+	{
+		printk("Sending energy report to 0x%04x failed\n", addr);
+	}
+}
+
+// The stack encrypts the message in place, every requester gets one built
+// for it
+static void send_energy_status(struct k_work *work)
+{
+	static struct energy_report report;
+	uint16_t addrs[ENERGY_REPLY_MAX];
+	k_spinlock_key_t key;
+	uint8_t count;
+	int i;
+
+	key = k_spin_lock(&energy_reply_lock);
+	count = energy_reply_count;
+	memcpy(addrs, energy_reply_addrs, sizeof(addrs));
+	energy_reply_count = 0U;
+	k_spin_unlock(&energy_reply_lock, key);
+
+	energy_report(&report);
+
+	for (i = 0; i < count; i++)
+	{
+		send_energy_status_to(addrs[i], &report);
+	}
+}
+
+// Commissioning messages go out from whatever address the node has, the
+// claimed address travels in the payload. They keep the full TTL, a conflict
+// can be anywhere in the network.
+static void send_commission_msg(uint32_t op, uint16_t addr, const uint8_t *id)
+{
+	NET_BUF_SIMPLE_DEFINE(msg, 3 + ADDR_SIZE + COMMISSION_ID_SIZE + 4);
+
+	struct bt_mesh_msg_ctx ctx = 
+	{
+		.app_idx = APP_IDX,
+		.addr = GROUP_ADDR,
+		.send_ttl = DEFAULT_TTL,
+	};
+
+	bt_mesh_model_msg_init(&msg, op);
+	net_buf_simple_add_le16(&msg, addr);
+	net_buf_simple_add_mem(&msg, id, COMMISSION_ID_SIZE);
+
+	if (model_send(&vnd_models[0], &ctx, &msg))
+	{
+		printk("Sending commissioning message failed\n");
+	}
+}
+
+void mesh_send_probe(uint16_t addr, const uint8_t *id)
+{
+	send_commission_msg(OP_VND_PROBE, addr, id);
+}
+
+void mesh_send_conflict(uint16_t addr, const uint8_t *winner_id)
+{
+	send_commission_msg(OP_VND_CONFLICT, addr, winner_id);
+}
+
+// Beacons and reports only go one hop, the tree does the routing
+void mesh_send_beacon(uint16_t sink, uint8_t depth, uint16_t parent)
+{
+	NET_BUF_SIMPLE_DEFINE(msg, 3 + AGG_BEACON_SIZE + 4);
+
+	struct bt_mesh_msg_ctx ctx = 
+	{
+		.app_idx = APP_IDX,
+		.addr = GROUP_ADDR,
+		.send_ttl = 0,
+	};
+
+	bt_mesh_model_msg_init(&msg, OP_VND_AGG_BEACON);
+	net_buf_simple_add_le16(&msg, sink);
+	net_buf_simple_add_u8(&msg, depth);
+	net_buf_simple_add_le16(&msg, parent);
+
+	model_send(&vnd_models[0], &ctx, &msg);
+}
+
+void mesh_send_time_beacon(uint16_t master, uint8_t stratum, uint32_t time)
+{
+	NET_BUF_SIMPLE_DEFINE(msg, 3 + TIME_BEACON_SIZE + 4);
+
+	struct bt_mesh_msg_ctx ctx = 
+	{
+		.app_idx = APP_IDX,
+		.addr = GROUP_ADDR,
+		.send_ttl = 0,
+	};
+
+	bt_mesh_model_msg_init(&msg, OP_VND_TIME_BEACON);
+	net_buf_simple_add_le16(&msg, master);
+	net_buf_simple_add_u8(&msg, stratum);
+	net_buf_simple_add_le32(&msg, time);
+
+	model_send(&vnd_models[0], &ctx, &msg);
+}
+
+// Sent from the stack's receive path as well, when the previous page arrives
+void mesh_send_stats_get(uint16_t addr, uint8_t page)
+{
+	NET_BUF_SIMPLE_DEFINE(msg, 3 + 1 + 4);
+
+	struct bt_mesh_msg_ctx ctx = 
+	{
+		.app_idx = APP_IDX,
+		.addr = addr,
+		.send_ttl = ttl_ctl_get(),
+	};
+
+	bt_mesh_model_msg_init(&msg, OP_VND_STATS_GET);
+	net_buf_simple_add_u8(&msg, page);
+
+	if (model_send(&vnd_models[0], &ctx, &msg))
+	{
+		printk("Sending stats request to 0x%04x failed\n", addr);
+	}
+}
+
+void mesh_send_report(uint16_t parent, const struct aggregate_report *report)
+{
+	NET_BUF_SIMPLE_DEFINE(msg, AGG_REPORT_MSG_SIZE);
+
+	struct bt_mesh_msg_ctx ctx = 
+	{
+		.app_idx = APP_IDX,
+		.addr = parent,
+		.send_ttl = 0,
+	};
+
+	int i;
+
+	bt_mesh_model_msg_init(&msg, OP_VND_AGG_REPORT);
+	net_buf_simple_add_u8(&msg, report->nodes);
+	net_buf_simple_add_le16(&msg, report->temp_min);
+	net_buf_simple_add_le16(&msg, report->temp_max);
+	net_buf_simple_add_le32(&msg, report->temp_sum);
+	net_buf_simple_add_u8(&msg, report->edge_count);
+
+	for (i = 0; i < report->edge_count; i++)
+	{
+		net_buf_simple_add_le16(&msg, report->edges[i].a);
+		net_buf_simple_add_le16(&msg, report->edges[i].b);
+		net_buf_simple_add_u8(&msg, report->edges[i].distance);
+	}
+
+	if (model_send(&vnd_models[0], &ctx, &msg))
+	{
+		printk("Sending report to 0x%04x failed\n", parent);
+	}
+}
+
+int mesh_provision(uint16_t addr)
 {
 	static const uint8_t net_key[16] = {
 		0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0xcc,
@@ -615,15 +1439,7 @@ static int provision_and_configure(void)
 		0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa,
 	};
 
-	struct bt_mesh_cfg_mod_pub pub = {
-		.addr = GROUP_ADDR,
-		.app_idx = APP_IDX,
-		.ttl = DEFAULT_TTL,
-		.period = BT_MESH_PUB_PERIOD_SEC(10),
-	};
-
 	uint8_t dev_key[16];
-	uint16_t addr;
 	int err;
 
 	err = bt_rand(dev_key, sizeof(dev_key));
@@ -631,18 +1447,6 @@ static int provision_and_configure(void)
 	if (err) 
 		return err;
 
-	do 
-	{
-		err = bt_rand(&addr, sizeof(addr));
-
-		if (err)
-			return err;
-			
-	} while (!addr);
-
-	/* Make sure it's a unicast address (highest bit unset) */
-	addr &= ~0x8000;
-
 	err = bt_mesh_provision(net_key, NET_IDX, FLAGS, IV_INDEX, addr,
 				dev_key);
 
@@ -664,6 +1468,9 @@ static int provision_and_configure(void)
 	bt_mesh_cfg_mod_app_bind(NET_IDX, addr, addr, APP_IDX,
 					BT_MESH_MODEL_ID_SENSOR_SRV, NULL);
 
+	bt_mesh_cfg_mod_app_bind(NET_IDX, addr, addr, APP_IDX,
+					BT_MESH_MODEL_ID_SENSOR_SETUP_SRV, NULL);
+
 	/* Bind to Health model */
 	bt_mesh_cfg_mod_app_bind(NET_IDX, addr, addr, APP_IDX,
 					BT_MESH_MODEL_ID_HEALTH_SRV, NULL);
@@ -672,30 +1479,117 @@ static int provision_and_configure(void)
 	bt_mesh_cfg_mod_sub_add_vnd(NET_IDX, addr, addr, GROUP_ADDR,
 					MOD_LF, BT_COMP_ID_LF, NULL);
 
+	return 0;
+}
+
+// Publishing starts only once the address is known to be ours
+void mesh_configure_publication(void)
+{
+	uint16_t addr = mesh_get_addr();
+
+	/* With aggregation the heartbeats only feed the neighbor tables */
+	struct bt_mesh_cfg_mod_pub pub = {
+		.addr = GROUP_ADDR,
+		.app_idx = APP_IDX,
+		.ttl = MESH_AGGREGATE ? 0 : ttl_ctl_get(),
+		.period = BT_MESH_PUB_PERIOD_SEC(HEARTBEAT_PERIOD_SEC),
+	};
+
+	/* Slow cadence, the triggers take care of the changes */
+	struct bt_mesh_cfg_mod_pub sensor_pub = {
+		.addr = GROUP_ADDR,
+		.app_idx = APP_IDX,
+		.ttl = ttl_ctl_get(),
+		.period = BT_MESH_PUB_PERIOD_10SEC(6),
+	};
+
 	bt_mesh_cfg_mod_pub_set_vnd(NET_IDX, addr, addr, MOD_LF, BT_COMP_ID_LF,
 				    &pub, NULL);
 
+	bt_mesh_cfg_mod_pub_set(NET_IDX, addr, addr,
+				BT_MESH_MODEL_ID_SENSOR_SRV, &sensor_pub, NULL);
+
 	printk("Configuration complete\n");
-	// printk("Hello message from 0x%04x \n", addr);
+}
+
+// Takes effect from the next publication, the TTL controller sets it again
+// after a reboot
+void mesh_ttl_update(uint8_t ttl)
+{
+	if (!mesh_is_configured())
+	{
+		return;
+	}
+
+	if (!MESH_AGGREGATE)
+	{
+		vnd_models[0].pub->ttl = ttl;
+	}
 
-	return addr;
+	SENSOR_SRV_MODEL->pub->ttl = ttl;
 }
 
-static void start_mesh(struct k_work *work)
+// Takes effect from the next publication like the TTL, the power level sets
+// it again after a reboot
+void mesh_heartbeat_period_set(uint8_t period_sec)
 {
-	int err;
+	if (!mesh_is_configured())
+	{
+		return;
+	}
 
-	err = provision_and_configure();
-	if (err < 0) {
-		board_show_text("Starting Mesh Failed", false,
-				K_SECONDS(2));
-	} else {
-		char buf[32];
+	vnd_models[0].pub->period = period_sec <= BIT_MASK(6) ?
+				    BT_MESH_PUB_PERIOD_SEC(period_sec) :
+				    BT_MESH_PUB_PERIOD_10SEC(period_sec / 10);
+}
 
-		snprintk(buf, sizeof(buf),
-			 "Mesh Started\nAddr: 0x%04x", err);
-		board_show_text(buf, false, K_SECONDS(4));
+// Goes through the local Configuration Server, so the state is stored like
+// any other configuration change
+int mesh_relay_set(bool enable)
+{
+	uint16_t addr = mesh_get_addr();
+
+	if (!IS_ENABLED(CONFIG_BT_MESH_RELAY))
+	{
+		return -ENOTSUP;
+	}
+
+	if (!mesh_is_configured())
+	{
+		return -EAGAIN;
+	}
+
+	return bt_mesh_cfg_relay_set(NET_IDX, addr,
+				     enable ? BT_MESH_RELAY_ENABLED :
+					      BT_MESH_RELAY_DISABLED,
+				     BT_MESH_TRANSMIT(2, 20), NULL, NULL);
+}
+
+int mesh_friend_set(bool enable)
+{
+	uint16_t addr = mesh_get_addr();
+
+	if (!IS_ENABLED(CONFIG_BT_MESH_FRIEND))
+	{
+		return -ENOTSUP;
 	}
+
+	return bt_mesh_cfg_friend_set(NET_IDX, addr,
+				      enable ? BT_MESH_FRIEND_ENABLED :
+					       BT_MESH_FRIEND_DISABLED, NULL);
+}
+
+void mesh_unprovision(void)
+{
+	if (mesh_is_initialized())
+	{
+		bt_mesh_reset();
+	}
+}
+
+static void start_mesh(struct k_work *work)
+{
+	commission_start();
 }
 
 void mesh_start(void)
@@ -708,6 +1602,11 @@ bool mesh_is_initialized(void)
 	return elements[0].addr != BT_MESH_ADDR_UNASSIGNED;
 }
 
+bool mesh_is_configured(void)
+{
+	return vnd_models[0].pub->addr != BT_MESH_ADDR_UNASSIGNED;
+}
+
 uint16_t mesh_get_addr(void)
 {
 	return elements[0].addr;
@@ -720,9 +1619,22 @@ int mesh_init(void)
 		.uuid = dev_uuid,
 	};
 
+	heartbeat_seq = sys_rand32_get();
+
 	k_work_init(&calibration_work, send_calibration);
 	k_work_init(&baduser_work, send_baduser);
 	k_work_init(&mesh_start_work, start_mesh);
+	k_work_init(&energy_get_work, send_energy_get);
+	k_delayed_work_init(&energy_reply_work, send_energy_status);
+	commission_init();
+	aggregate_init();
+	ttl_ctl_init();
+	relay_ctl_init();
+	friendship_init();
+	power_init();
+	energy_init();
+	trace_init();
+	diag_init();
 
 	initialize_app();
 	printk("Mesh app initialized.\n");
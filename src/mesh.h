@@ -19,9 +19,54 @@
 #define BT_MESH_MODEL_OP_SENS_GET		BT_MESH_MODEL_OP_2(0x82, 0x31)
 #define BT_MESH_MODEL_OP_SENS_COL_GET		BT_MESH_MODEL_OP_2(0x82, 0x32)
 #define BT_MESH_MODEL_OP_SENS_SERIES_GET	BT_MESH_MODEL_OP_2(0x82, 0x33)
+#define BT_MESH_MODEL_OP_SENS_CADENCE_GET	BT_MESH_MODEL_OP_2(0x82, 0x34)
+#define BT_MESH_MODEL_OP_SENS_SETTINGS_GET	BT_MESH_MODEL_OP_2(0x82, 0x35)
+#define BT_MESH_MODEL_OP_SENS_SETTING_GET	BT_MESH_MODEL_OP_2(0x82, 0x36)
 
 #define BT_MESH_MODEL_OP_SENS_DESC_STATUS	BT_MESH_MODEL_OP_1(0x51)
 #define BT_MESH_MODEL_OP_SENS_STATUS		BT_MESH_MODEL_OP_1(0x52)
+#define BT_MESH_MODEL_OP_SENS_CADENCE_SET	BT_MESH_MODEL_OP_1(0x55)
+#define BT_MESH_MODEL_OP_SENS_CADENCE_SET_UNACK	BT_MESH_MODEL_OP_1(0x56)
+#define BT_MESH_MODEL_OP_SENS_CADENCE_STATUS	BT_MESH_MODEL_OP_1(0x57)
+#define BT_MESH_MODEL_OP_SENS_SETTINGS_STATUS	BT_MESH_MODEL_OP_1(0x58)
+#define BT_MESH_MODEL_OP_SENS_SETTING_SET	BT_MESH_MODEL_OP_1(0x59)
+#define BT_MESH_MODEL_OP_SENS_SETTING_SET_UNACK	BT_MESH_MODEL_OP_1(0x5a)
+#define BT_MESH_MODEL_OP_SENS_SETTING_STATUS	BT_MESH_MODEL_OP_1(0x5b)
+
+/* Provision on boot instead of waiting for a name over GATT */
+#define MESH_AUTO_COMMISSION	1
+
+/* Merge readings toward a sink instead of flooding every heartbeat */
+#define MESH_AGGREGATE		0
+
+/* Time the message path on the board at boot instead of joining the mesh */
+#define MESH_BENCH		0
+
+/* Scripted sensors and a periodic CSV report, see sim.c */
+#define MESH_SIM		0
+
+/* Time-stamped heartbeats and latency histograms, see trace.c */
+#define MESH_TRACE		0
+
+/* TTL reaching the whole network, the TTL controller stays below it */
+#define MESH_TTL_MAX		31
+
+/* Publish period of the vendor heartbeat while the board is in use */
+#define HEARTBEAT_PERIOD_SEC	10
+
+/* Heartbeat header: initial TTL, sequence number, publish period and, with
+ * MESH_TRACE, the send time
+ */
+#define HEARTBEAT_HDR_SIZE	(1 + 2 + 1 + (MESH_TRACE ? 2 : 0))
+
+/* Lower transport PDUs of an access message of len octets, opcode included:
+ * one unsegmented up to 11 octets, else 12 octet segments that also carry
+ * the 4 octet TransMIC
+ */
+#define MESH_PDUS(len)		((len) <= 11 ? 1 : ceiling_fraction((len) + 4, 12))
+
+/* The largest heartbeat in PDUs, MAX_MESSAGE_SIZE is in mesh_app.h */
+#define HEARTBEAT_SEGS		MESH_PDUS(3 + HEARTBEAT_HDR_SIZE + MAX_MESSAGE_SIZE)
 
 struct led_onoff_state {
 	uint8_t current;
@@ -35,10 +80,30 @@ struct led_onoff_state {
 
 void mesh_send_calibration(void);
 void mesh_send_baduser(void);
+void mesh_send_energy_get(void);
+void mesh_sensor_update(int32_t temperature, int32_t humidity);
+
+void mesh_send_probe(uint16_t addr, const uint8_t *id);
+void mesh_send_conflict(uint16_t addr, const uint8_t *winner_id);
+
+struct aggregate_report;
+void mesh_send_beacon(uint16_t sink, uint8_t depth, uint16_t parent);
+void mesh_send_report(uint16_t parent, const struct aggregate_report *report);
+void mesh_send_time_beacon(uint16_t master, uint8_t stratum, uint32_t time);
+void mesh_send_stats_get(uint16_t addr, uint8_t page);
+
+int mesh_provision(uint16_t addr);
+void mesh_configure_publication(void);
+void mesh_unprovision(void);
+void mesh_ttl_update(uint8_t ttl);
+void mesh_heartbeat_period_set(uint8_t period_sec);
+int mesh_relay_set(bool enable);
+int mesh_friend_set(bool enable);
 
 uint16_t mesh_get_addr(void);
 const char* get_bluetooth_name(void);
 void copy_bluetooth_name(char*);
 bool mesh_is_initialized(void);
+bool mesh_is_configured(void);
 void mesh_start(void);
 int mesh_init(void);
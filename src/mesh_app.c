@@ -1,49 +1,103 @@
 #include <zephyr.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <math.h>
+
+#include <drivers/sensor.h>
 
 #include "mesh_app.h"
 #include "mesh.h"
+#include "board.h"
+#include "app_log.h"
+#include "aggregate.h"
+#include "gateway.h"
+#include "relay_ctl.h"
+#include "friendship.h"
+#include "power.h"
+#include "energy.h"
+#include "trace.h"
+#include "tune.h"
+#include "fmt.h"
 
 // ======================================== CONST Configurations ======================================== //
 
-const int ACCEPTABLE_THRESHOLD = 20;
-const int CALIBRATION_START_MIN = 255 - ACCEPTABLE_THRESHOLD;
+// The acceptable threshold and the environmental factor are tuned at
+// runtime, see tune.h
 const int CALIBRATION_START_MAX = 255;
 const int CALIBRATION_END_MIN = 20;
-const int CALIBRATION_END_MAX = CALIBRATION_END_MIN + ACCEPTABLE_THRESHOLD;
 
-const float MIN_PROXIMITY_DISTANCE = 0.05;
-const float MAX_PROXIMITY_DISTANCE = 0.24;
-const float PROXIMITY_TO_METER = MAX_PROXIMITY_DISTANCE / 235;
+// Proximity 255 down to 20 is 0 to 0.24 m, in um
+const int32_t MIN_PROXIMITY_DISTANCE_UM = 50000;
+const int32_t MAX_PROXIMITY_DISTANCE_UM = 240000;
+
+// A new distance estimate weighs 1/4 in the filtered distance (EWMA)
+const int DISTANCE_FILTER_DIVISOR = 4;
+
+// 10^(i/20) in 1/65536, the decade in steps of 0.05 for log10_milli() and
+// exp10_milli()
+static const uint32_t EXP10_TABLE[] = {
+    65536, 73533, 82505, 92572, 103868, 116541, 130762, 146717, 164619, 184706,
+    207243, 232531, 260904, 292739, 328458, 368536, 413504, 463959, 520571,
+    584090, 655360,
+};
 
-const int ENVIRONMENTAL_FACTOR = 2 * 10;
+#define EXP10_STEP 50
+#define EXP10_STEPS (ARRAY_SIZE(EXP10_TABLE) - 1)
 
-#define POST_DATA_INTERVAL K_MINUTES(1)
+// Own fields in front of the neighbor list: "name,-99.9,100;"
+BUILD_ASSERT(NAME_SIZE - 1 + sizeof(",-99.9,100;") <= CONFIG_APP_NODE_FIELDS_SIZE,
+             "APP_NODE_FIELDS_SIZE can't hold the name and the readings");
+// At most at the same time: the mesh summary of print_mesh_summary(), the
+// node buffer of get_mesh_summary() and the heartbeat being published
+BUILD_ASSERT((MAX_NODES + 3) * MAX_MESSAGE_SIZE <= CONFIG_MINIMAL_LIBC_MALLOC_ARENA_SIZE,
+             "Mesh summary and heartbeat don't fit the malloc arena");
 
 // ======================================== Global Variables ======================================== //
 
-double average_node_temperature;
+int32_t average_node_temperature;
 
 struct node_data self_node_data;
+int self_proximity;
 
 int current_nodes = 0;
 struct node_data neighbor_nodes_data[MAX_NODES];
 
-static struct k_delayed_work post_data_work;
+// Neighbor indexes ordered by filtered distance, nearest first, and the
+// position of every neighbor in that order
+int neighbor_order[MAX_NODES];
+static int neighbor_rank[MAX_NODES];
+
+// Samples of the calibrations in progress. Only a node held next to this
+// one calibrates, so a few sessions do instead of samples in every record.
+struct calibration_session
+{
+    uint16_t address; // 0 when free
+    uint32_t last_used;
+    uint8_t proximity_values[CALIBRATION_STEPS];
+    int8_t rssi_values[CALIBRATION_STEPS];
+};
+
+static struct calibration_session calibration_sessions[CALIBRATION_SESSIONS];
+
+// Heap allocations made so far, the benchmark reports them per call
+uint32_t mesh_app_allocs;
 
 // ======================================== Functions ======================================== //
 
-void get_mesh_summary(char*);
+static void *app_malloc(size_t size)
+{
+    mesh_app_allocs++;
 
-void post_data();
+    return malloc(size);
+}
+
+void get_mesh_summary(char*);
 
 void print_mesh_summary()
 {
     int length = (current_nodes + 1) * MAX_MESSAGE_SIZE;
-    char *data = (char*)malloc(length * sizeof(char));
+    char *data = (char*)app_malloc(length * sizeof(char));
 
     if (data == NULL)
     {
@@ -59,30 +113,93 @@ void print_mesh_summary()
     get_mesh_summary(data);
 
     printf("%s", data);
+
+    free(data);
 }
 
-void print_node_status(struct node_data n)
+// Writes the neighbor list of a node the way the heartbeat carries it,
+// "NeighborCount{,ID:Distance}*", and returns its end
+char *format_neighbor_distances(const struct node_data *n, char *buffer)
 {
-    printf("name: %s address: 0x%04x calibration_step: %d is_calibrated: %d rssi_distance_factor: %.1f rssi: %d distance: %.1f temperature: %.1f humidity: %d neighbor_distances: '%s'\n", 
-        n.name, n.address, n.calibration_step,
-        n.is_calibrated, n.rssi_distance_factor,
-        n.rssi, n.distance, 
-        n.temperature, n.humidity,
-        n.neighbor_distances);
+    buffer = fmt_int(buffer, n->neighbor_count);
+
+    for (int i = 0; i < n->neighbor_count; i++)
+    {
+        buffer = fmt_str(buffer, ",");
+        buffer = fmt_hex16(buffer, n->neighbor_distances[i].address);
+        buffer = fmt_str(buffer, ":");
+        buffer = fmt_fixed(buffer, n->neighbor_distances[i].distance, 1, 0);
+    }
+
+    return buffer;
 }
 
-void print_status_update()
+void print_node_status(const struct node_data *n)
 {
-    printk("==================== MESH APP STATUS UPDATE ====================\n");
+    char neighbor_distances[NEIGHBOR_DISTANCES_LENGTH];
+    char rssi_distance_factor[8];
+    char distance[8];
+    char temperature[8];
+
+    format_neighbor_distances(n, neighbor_distances);
+    fmt_fixed(rssi_distance_factor, n->rssi_distance_factor, 1, 0);
+    fmt_fixed(distance, n->distance, 1, 0);
+    fmt_fixed(temperature, n->temperature, 1, 0);
+
+    printf("name: %s address: 0x%04x calibration_step: %d is_calibrated: %d rssi_distance_factor: %s rssi: %d distance: %s temperature: %s humidity: %d neighbor_distances: '%s'\n", 
+        n->name, n->address, n->calibration_step,
+        n->is_calibrated, rssi_distance_factor,
+        n->rssi, distance, 
+        temperature, n->humidity,
+        neighbor_distances);
+}
 
+void print_node_table()
+{
     printk("current_nodes: %d\n", current_nodes);
 
     for (int i = 0; i < current_nodes; i++)
     {
         printk("%d) ", i);
-        print_node_status(neighbor_nodes_data[i]);
+        print_node_status(&neighbor_nodes_data[i]);
+    }
+}
+
+void print_ram_usage()
+{
+    unsigned int record = sizeof(struct node_data);
+    unsigned int table = sizeof(neighbor_nodes_data) + sizeof(neighbor_order) + sizeof(neighbor_rank);
+    unsigned int sessions = sizeof(calibration_sessions);
+    int calibrating = 0;
+
+    for (int i = 0; i < CALIBRATION_SESSIONS; i++)
+    {
+        if (calibration_sessions[i].address != 0)
+            calibrating++;
     }
 
+    printk("RAM: node table %u bytes (%d records of %u), calibration %u bytes (%d/%d sessions in use)\n",
+        table, MAX_NODES, record, sessions, calibrating, CALIBRATION_SESSIONS);
+}
+
+void print_status_update()
+{
+    printk("==================== MESH APP STATUS UPDATE ====================\n");
+
+    print_node_table();
+    print_ram_usage();
+
+    printf("--------------------------------\n");
+    board_print_link_stats();
+    aggregate_print();
+    gateway_print();
+    relay_ctl_print();
+    friendship_print();
+    power_print();
+    energy_print();
+    trace_print();
+    tune_print();
+
     printf("--------------------------------\n");
     printf("Mesh app summary:\n");
     print_mesh_summary();
@@ -106,34 +223,20 @@ void initialize_app()
         n.calibration_step = 0;
         n.is_calibrated = 0;
 
-        for (int j = 0; j < CALIBRATION_STEPS; j++)
-        {
-            n.calibration_proximity_values[j] = 0;
-            n.calibration_rssi_values[j] = 0;
-        }
-
         n.rssi_distance_factor = 0;
         n.rssi = 0;
         n.distance = 0;
+        n.filtered_distance = 0;
         n.temperature = 0;
         n.humidity = 0;
-        n.proximity = 0;
-        n.light = 0;
 
-        for (int k = 0; k < NEIGHBOR_DISTANCES_LENGTH; k++)
-        {
-            n.neighbor_distances[k] = '\0';
-        }
-
-        n.neighbor_distances[0] = '0';
+        n.neighbor_count = 0;
+        memset(n.neighbor_distances, 0, sizeof(n.neighbor_distances));
         
         neighbor_nodes_data[i] = n;
     }
 
-	k_delayed_work_init(&post_data_work, post_data);
-    k_delayed_work_submit(&post_data_work, POST_DATA_INTERVAL);
-
-    print_status_update();
+    app_log_snapshot_request();
 }
 
 int find_node(uint16_t address)
@@ -154,29 +257,93 @@ int add_node_if_not_exists(uint16_t address, char *name)
     if (found_index != -1)
         return found_index;
 
+    if (current_nodes == MAX_NODES)
+        return -1;
+
     neighbor_nodes_data[current_nodes].address = address;
-    strcpy(neighbor_nodes_data[current_nodes].name, name);
+    // Received names may be NAME_SIZE long, one more than the record holds
+    strncpy(neighbor_nodes_data[current_nodes].name, name, NAME_SIZE - 1);
+    neighbor_nodes_data[current_nodes].name[NAME_SIZE - 1] = '\0';
+
+    // Not calibrated yet, so it goes last
+    neighbor_order[current_nodes] = current_nodes;
+    neighbor_rank[current_nodes] = current_nodes;
 
     current_nodes++;
 
     return current_nodes - 1;
 }
 
-double calculate_measured_power(int rssi, float distance)
+// a / b rounded half away from zero, like lround(), for b > 0
+static int32_t div_round(int32_t a, int32_t b)
 {
-    if (distance == 0)
-        distance = MIN_PROXIMITY_DISTANCE;
+    return (a < 0 ? a - b / 2 : a + b / 2) / b;
+}
+
+// 1000 * log10(x) for x >= 1, interpolated in EXP10_TABLE. Off by less than
+// 0.002 decades from log10()
+static int32_t log10_milli(uint32_t x)
+{
+    uint32_t scale = 1;
+    int32_t decades = 0;
+
+    while (x / scale >= 10)
+    {
+        scale *= 10;
+        decades++;
+    }
 
-    double d = log10(distance);
-    d *= ENVIRONMENTAL_FACTOR;
-    double measured_power = d + rssi;
+    // x / scale, in [1, 10)
+    uint32_t m = ((uint64_t)x << 16) / scale;
+    int i = 0;
 
-    return measured_power;
+    while (i < EXP10_STEPS - 1 && EXP10_TABLE[i + 1] <= m)
+        i++;
+
+    uint32_t step = EXP10_TABLE[i + 1] - EXP10_TABLE[i];
+
+    return decades * 1000 + i * EXP10_STEP + (EXP10_STEP * (m - EXP10_TABLE[i]) + step / 2) / step;
+}
+
+// 10^(e / 1000), rounded and saturated at UINT32_MAX. Off by less than 0.2%
+// from pow()
+static uint32_t exp10_milli(int32_t e)
+{
+    int32_t decades = e >= 0 ? e / 1000 : -((999 - e) / 1000);
+    int32_t f = e - decades * 1000;
+    int i = f / EXP10_STEP;
+    uint64_t m = EXP10_TABLE[i] +
+        (uint64_t)(EXP10_TABLE[i + 1] - EXP10_TABLE[i]) * (f % EXP10_STEP) / EXP10_STEP;
+    uint64_t div = 1 << 16;
+
+    if (decades > 9)
+        return UINT32_MAX;
+
+    for (; decades > 0; decades--)
+        m *= 10;
+
+    if (decades < -9)
+        return 0;
+
+    for (; decades < 0; decades++)
+        div *= 10;
+
+    return MIN((m + div / 2) / div, UINT32_MAX);
+}
+
+// The RSSI at 1 m a calibration sample gives, in 0.01 dBm
+int32_t calculate_measured_power(int rssi, int32_t distance_um)
+{
+    if (distance_um == 0)
+        distance_um = MIN_PROXIMITY_DISTANCE_UM;
+
+    return rssi * 100 + div_round(tune.environmental_factor * (log10_milli(distance_um) - 6000), 10);
 }
 
 void update_average_temperature()
 {
-    double new_value = 0;
+    int count = current_nodes + 1;
+    int32_t new_value = 0;
 
     // Add other nodes temperature
     for (int i = 0; i < current_nodes; i++)
@@ -187,27 +354,135 @@ void update_average_temperature()
     // Add self temperature
     new_value += self_node_data.temperature;
 
-    // Get the average
-    new_value /= current_nodes + 1;
+    // Get the average in 0.01 C, rounded half away from zero
+    new_value *= 10;
+    new_value = (new_value + (new_value < 0 ? -count : count) / 2) / count;
+
+    // The screen shows two decimals, redraw when they change
+    if (new_value != average_node_temperature)
+        board_model_changed(BOARD_MODEL_AVERAGE);
 
     average_node_temperature = new_value;
 }
 
+int32_t neighbor_sort_key(int node_index)
+{
+    struct node_data *n = &neighbor_nodes_data[node_index];
+
+    // Nodes without a distance estimate sort after every calibrated one
+    if (n->is_calibrated == 0)
+        return INT32_MAX;
+
+    return n->filtered_distance;
+}
+
+void swap_neighbor_order(int rank_a, int rank_b)
+{
+    int node_a = neighbor_order[rank_a];
+    int node_b = neighbor_order[rank_b];
+
+    neighbor_order[rank_a] = node_b;
+    neighbor_order[rank_b] = node_a;
+    neighbor_rank[node_b] = rank_a;
+    neighbor_rank[node_a] = rank_b;
+}
+
+// The order only changes around the updated node, so move it to its new
+// place instead of sorting the whole list again
+void update_neighbor_order(int node_index)
+{
+    int32_t key = neighbor_sort_key(node_index);
+    int rank = neighbor_rank[node_index];
+
+    while (rank > 0 && neighbor_sort_key(neighbor_order[rank - 1]) > key)
+    {
+        swap_neighbor_order(rank, rank - 1);
+        rank--;
+    }
+
+    while (rank < current_nodes - 1 && neighbor_sort_key(neighbor_order[rank + 1]) < key)
+    {
+        swap_neighbor_order(rank, rank + 1);
+        rank++;
+    }
+}
+
+struct node_data *get_sorted_neighbor(int rank)
+{
+    return &neighbor_nodes_data[neighbor_order[rank]];
+}
+
 void update_node_estimated_distance(struct node_data *n)
 {
     if (n->is_calibrated == 0)
         return;
 
-    n->distance = pow(10, (n->rssi_distance_factor - n->rssi)/ENVIRONMENTAL_FACTOR);
+    // Path loss in decades of distance, in 1/1000, 2000 more for the cm
+    int32_t decades = (n->rssi_distance_factor - 10 * n->rssi) * 100 / tune.environmental_factor;
+    int32_t distance_cm = MIN(exp10_milli(decades + 2000), UINT16_MAX);
+
+    if (n->distance == 0)
+        n->filtered_distance = distance_cm;
+    else
+        n->filtered_distance += div_round(distance_cm - n->filtered_distance, DISTANCE_FILTER_DIVISOR);
+
+    n->distance = MIN((distance_cm + 5) / 10, NEIGHBOR_DISTANCE_MAX);
+
+    update_neighbor_order(n - neighbor_nodes_data);
 }
 
-void check_node_calibration(struct node_data *n)
+// The session of a node, else a free one, else the one used least recently,
+// whose node has to start its calibration over
+struct calibration_session *get_calibration_session(uint16_t address)
 {
-    if (CALIBRATION_STEPS <= n->calibration_step)
+    struct calibration_session *session = &calibration_sessions[0];
+    uint32_t now = k_uptime_get_32();
+
+    for (int i = 0; i < CALIBRATION_SESSIONS; i++)
+    {
+        if (calibration_sessions[i].address == address)
+        {
+            calibration_sessions[i].last_used = now;
+            return &calibration_sessions[i];
+        }
+    }
+
+    for (int i = 0; i < CALIBRATION_SESSIONS; i++)
     {
-        printf("Calibrate finalizing.\n");
+        struct calibration_session *s = &calibration_sessions[i];
 
-        double measured_power_average = 0;
+        if (s->address == 0)
+        {
+            session = s;
+            break;
+        }
+
+        if ((int32_t)(s->last_used - session->last_used) < 0)
+            session = s;
+    }
+
+    if (session->address != 0)
+    {
+        int node_index = find_node(session->address);
+
+        printk("Calibration of 0x%04x dropped for 0x%04x\n", session->address, address);
+
+        if (node_index != -1)
+            neighbor_nodes_data[node_index].calibration_step = 0;
+    }
+
+    memset(session, 0, sizeof(*session));
+    session->address = address;
+    session->last_used = now;
+
+    return session;
+}
+
+void check_node_calibration(struct node_data *n, struct calibration_session *session)
+{
+    if (CALIBRATION_STEPS <= n->calibration_step)
+    {
+        int32_t measured_power_sum = 0;
 
         for (int i = 0; i < n->calibration_step; i++)
         {
@@ -216,17 +491,19 @@ void check_node_calibration(struct node_data *n)
             // NOTE: See the following page for the formula:
             // https://iotandelectronics.wordpress.com/2016/10/07/
 
-            double measured_power = calculate_measured_power(n->calibration_rssi_values[i],
-                (255 - n->calibration_proximity_values[i]) * PROXIMITY_TO_METER);
-
-            measured_power_average += measured_power / n->calibration_step;
+            measured_power_sum += calculate_measured_power(session->rssi_values[i],
+                (255 - session->proximity_values[i]) * MAX_PROXIMITY_DISTANCE_UM / 235);
         }
 
-        printf("measured_power_average calculated: %f.\n", measured_power_average);
+        app_log(APP_LOG_CAT_CALIBRATION, APP_LOG_LEVEL_INF, APP_LOG_EVT_CALIBRATED,
+            n->address, div_round(measured_power_sum, n->calibration_step), 0);
 
-        n->rssi_distance_factor = measured_power_average;
+        n->rssi_distance_factor = div_round(measured_power_sum, n->calibration_step * 10);
         n->is_calibrated = 1;
 
+        // Done with the samples
+        session->address = 0;
+
         update_node_estimated_distance(n);
     }
     else
@@ -247,18 +524,26 @@ int calibrate_node(uint16_t address, char *name, int proximity, int rssi)
 {
     int node_index = add_node_if_not_exists(address, name);
 
+    if (node_index == -1)
+        return -1;
+
     node_data *node = &neighbor_nodes_data[node_index];
 
     if (is_valid_calibration(proximity) && node->calibration_step < CALIBRATION_STEPS)
     {
-        node->calibration_proximity_values[node->calibration_step] = proximity;
-        node->calibration_rssi_values[node->calibration_step] = rssi;
+        struct calibration_session *session = get_calibration_session(address);
+
+        session->proximity_values[node->calibration_step] = proximity;
+        session->rssi_values[node->calibration_step] = rssi;
         node->calibration_step++;
 
         int first_calibration = !node->is_calibrated;
-        check_node_calibration(node);
+        check_node_calibration(node, session);
+
+        app_log(APP_LOG_CAT_CALIBRATION, APP_LOG_LEVEL_INF, APP_LOG_EVT_CALIBRATION_STEP,
+            address, node->calibration_step, node->is_calibrated);
 
-        print_status_update();
+        board_model_changed(BOARD_MODEL_NODES);
         
         return first_calibration;
     }
@@ -271,102 +556,129 @@ void get_self_node_message(char *buffer)
     if (strlen(self_node_data.name) == 0)
         copy_bluetooth_name(self_node_data.name);
 
-    char neighbor_distances[NEIGHBOR_DISTANCES_LENGTH];
-    sprintf(neighbor_distances, "%d", current_nodes);
-
     for (int i = 0; i < current_nodes; i++)
     {
-        char node_distance[20];
+        self_node_data.neighbor_distances[i].address = neighbor_nodes_data[i].address;
+        self_node_data.neighbor_distances[i].distance = neighbor_nodes_data[i].distance;
+    }
 
-        sprintf(node_distance, ",%04x:%.1f", 
-            neighbor_nodes_data[i].address, neighbor_nodes_data[i].distance);
+    self_node_data.neighbor_count = current_nodes;
+    self_node_data.address = mesh_get_addr();
 
-        strcat(neighbor_distances, node_distance);
-    }
+    // "Name,Temperature,Humidity;NeighborCount{,ID:Distance}*"
+    char *end = fmt_str(buffer, self_node_data.name);
+    end = fmt_str(end, ",");
+    end = fmt_fixed(end, self_node_data.temperature, 1, 0);
+    end = fmt_str(end, ",");
+    end = fmt_int(end, self_node_data.humidity);
+    end = fmt_str(end, ";");
+    end = format_neighbor_distances(&self_node_data, end);
 
-    strcpy(self_node_data.neighbor_distances, neighbor_distances);
+    app_log(APP_LOG_CAT_HEARTBEAT_TX, APP_LOG_LEVEL_DBG, APP_LOG_EVT_HEARTBEAT_TX,
+        self_node_data.address, end - buffer, current_nodes);
 
-    sprintf(buffer, "%s,%.1f,%d;%s", 
-        self_node_data.name,
-        self_node_data.temperature,
-        self_node_data.humidity,
-        self_node_data.neighbor_distances);
-    
-    print_status_update();
+    gateway_node_update(&self_node_data);
 }
 
-void update_node_data(uint16_t address, int rssi, char* message_string)
+// Reads a "%.1f" value in tenths, further decimals are dropped
+int32_t parse_tenths(const char *string, char **end)
 {
-    int node_index = find_node(address);
+    int negative = (*string == '-');
+    unsigned long whole = strtoul(string + negative, end, 10);
+    int32_t value = MIN(whole, INT16_MAX) * 10;
 
-    if (node_index == -1)
-        return;
+    if (**end == '.' && isdigit((unsigned char)(*end)[1]))
+    {
+        value += (*end)[1] - '0';
 
-    neighbor_nodes_data[node_index].rssi = rssi;
+        for (*end += 2; isdigit((unsigned char)**end); (*end)++)
+            ;
+    }
+
+    return negative ? -value : value;
+}
 
-    char* parsing_copy = (char*)malloc(strlen(message_string) + 1);
+void update_node_data(uint16_t address, int rssi, char* message_string)
+{
+    int node_index = find_node(address);
 
-    if (parsing_copy == NULL)
+    if (node_index == -1)
     {
-        printf("Couldn't allocate memory for parsing_copy of the message.");
+        app_log(APP_LOG_CAT_HEARTBEAT_RX, APP_LOG_LEVEL_DBG, APP_LOG_EVT_NODE_UNKNOWN,
+            address, rssi, 0);
         return;
     }
 
-    strcpy(parsing_copy, message_string);
+    struct node_data *n = &neighbor_nodes_data[node_index];
+    char *end;
 
-    // Get the first segment containing node sensor data
-    char* token = strtok(parsing_copy, ";");
+    n->rssi = rssi;
 
-    // Iterate through the node sensor values
-    char* delimeter = ",";
-    token = strtok(parsing_copy, delimeter);
-    int token_index = 0;
+    // "Name,Temperature,Humidity;NeighborCount{,ID:Distance}*", parsed
+    // straight into the record
+    char *p = strchr(message_string, ',');
 
-    while (token != NULL) 
+    if (p != NULL)
     {
-        if (token_index == 1)
-        {
-            // First token indicates temperature
-            neighbor_nodes_data[node_index].temperature = atof(token);
-        }
-        else if (token_index == 2)
-        {
-            // Second token indicates humidity
-            neighbor_nodes_data[node_index].humidity = atoi(token);
-        }
-        else if (token_index > 2)
+        int32_t temperature = parse_tenths(p + 1, &end);
+
+        n->temperature = CLAMP(temperature, INT16_MIN, INT16_MAX);
+
+        if (*end == ',')
         {
-            break;
+            unsigned long humidity = strtoul(end + 1, &end, 10);
+
+            n->humidity = MIN(humidity, UINT8_MAX);
         }
-        
-        token = strtok(NULL, delimeter);
-        token_index++;
+
+        p = strchr(end, ';');
     }
 
-    // Get the second segment containing node neighbor distances
-    strcpy(parsing_copy, message_string);
-    token = strtok(parsing_copy, ";");
-    token = strtok(NULL, ";");
+    // The count in front of the list follows from the entries
+    n->neighbor_count = 0;
+
+    while (p != NULL && (p = strchr(p, ',')) != NULL && n->neighbor_count < MAX_NODES)
+    {
+        struct neighbor_distance *entry = &n->neighbor_distances[n->neighbor_count];
+
+        entry->address = strtoul(p + 1, &end, 16);
 
-    strcpy(neighbor_nodes_data[node_index].neighbor_distances, token);
+        if (*end != ':')
+            break;
+
+        int32_t distance = parse_tenths(end + 1, &end);
+
+        entry->distance = CLAMP(distance, 0, NEIGHBOR_DISTANCE_MAX);
+        n->neighbor_count++;
+
+        p = end;
+    }
 
     update_average_temperature();
-    update_node_estimated_distance(&neighbor_nodes_data[node_index]);
-    print_status_update();
+    update_node_estimated_distance(n);
+    board_model_changed(BOARD_MODEL_NODES);
+
+    app_log(APP_LOG_CAT_HEARTBEAT_RX, APP_LOG_LEVEL_DBG, APP_LOG_EVT_NODE_UPDATE,
+        address, rssi, n->temperature);
+
+    gateway_node_update(n);
 }
 
-void encode_node_data(struct node_data n, char* buffer)
+// "ID,Temperature,Humidity;NeighborCount{,ID:Distance}*"
+void encode_node_data(const struct node_data *n, char* buffer)
 {
-    sprintf(buffer, "%04x,%.1f,%d;%s", 
-        n.address,
-        n.temperature,
-        n.humidity,
-        n.neighbor_distances);
+    buffer = fmt_hex16(buffer, n->address);
+    buffer = fmt_str(buffer, ",");
+    buffer = fmt_fixed(buffer, n->temperature, 1, 0);
+    buffer = fmt_str(buffer, ",");
+    buffer = fmt_int(buffer, n->humidity);
+    buffer = fmt_str(buffer, ";");
+    format_neighbor_distances(n, buffer);
 }
 
 void get_mesh_summary(char* buffer)
 {
-    char* node_buffer = (char*)malloc(MAX_MESSAGE_SIZE * sizeof(char));
+    char* node_buffer = (char*)app_malloc(MAX_MESSAGE_SIZE * sizeof(char));
 
     if (node_buffer == NULL)
     {
@@ -374,40 +686,16 @@ void get_mesh_summary(char* buffer)
         return;
     }
 
-    encode_node_data(self_node_data, node_buffer);
+    encode_node_data(&self_node_data, node_buffer);
     strcat(buffer, node_buffer);
     strcat(buffer, "\n");
 
     for (int i = 0; i < current_nodes; i++)
     {
-        encode_node_data(neighbor_nodes_data[i], node_buffer);
+        encode_node_data(&neighbor_nodes_data[i], node_buffer);
         strcat(buffer, node_buffer);
         strcat(buffer, "\n");
     }
-}
-
-void post_data()
-{
-    int length = (current_nodes + 1) * MAX_MESSAGE_SIZE;
-    char *data = (char*)malloc(length * sizeof(char));
-
-    if (data == NULL)
-    {
-        printf("Couldn't allocate memory for data.");
-        return;
-    }
 
-    for (int i = 0; i < length; i++)
-    {
-        data[i] = '\0';
-    }
-
-    get_mesh_summary(data);
-
-    // Boss' code will go here..
-
-
-
-    // Repeat the work
-    k_delayed_work_submit(&post_data_work, POST_DATA_INTERVAL);
-}
\ No newline at end of file
+    free(node_buffer);
+}
@@ -1,49 +1,62 @@
 #include <zephyr.h>
 
-#define NAME_SIZE 8
-#define MAX_NODES 10
-#define CALIBRATION_STEPS 5
+// Capacities are set in Kconfig
+#define NAME_SIZE CONFIG_APP_NAME_SIZE
+#define MAX_NODES CONFIG_APP_MAX_NODES
+#define CALIBRATION_STEPS CONFIG_APP_CALIBRATION_STEPS
 
-// neighbor_distances string contains the following information:
-// "NeighborCount,<ID,Distance>*NeighborCount"
+// Calibrations running at the same time, see calibrate_node()
+#define CALIBRATION_SESSIONS CONFIG_APP_CALIBRATION_SESSIONS
+
+// The heartbeat carries the neighbor list as text:
+// "NeighborCount{,ID:Distance}*"
 // NeighborCount -> 2 characters
 // , -> 1 character
 // ID -> 4 characters
-// , -> 1 character
+// : -> 1 character
 // distance (%.1f) -> 5 characters
 #define NEIGHBOR_DISTANCES_LENGTH (2 + 1 + (4 + 1 + 5) * MAX_NODES)
 
+// Longest distance in the list in dm, the most 5 characters hold
+#define NEIGHBOR_DISTANCE_MAX 9999
+
 // Message contains self node data + neighbor distances
-#define MAX_MESSAGE_SIZE (100 + NEIGHBOR_DISTANCES_LENGTH)
+#define MAX_MESSAGE_SIZE (CONFIG_APP_NODE_FIELDS_SIZE + NEIGHBOR_DISTANCES_LENGTH)
 
-extern const int CALIBRATION_START_MIN;
 extern const int CALIBRATION_START_MAX;
 extern const int CALIBRATION_END_MIN;
-extern const int CALIBRATION_END_MAX;
 
+// Proximity windows of a calibration, as wide as the tuned threshold
+#define CALIBRATION_START_MIN (CALIBRATION_START_MAX - tune.acceptable_threshold)
+#define CALIBRATION_END_MAX (CALIBRATION_END_MIN + tune.acceptable_threshold)
+
+// One entry of the neighbor list of a node
+struct neighbor_distance
+{
+    uint16_t address;
+    uint16_t distance; // dm
+};
+
+// Readings are fixed point, in the units next to them. The samples of a
+// running calibration are kept aside, see calibrate_node().
 struct node_data
 {
     char name[NAME_SIZE];
 
     uint16_t address;
 
-    int calibration_step;
-    int calibration_proximity_values[CALIBRATION_STEPS];
-    int calibration_rssi_values[CALIBRATION_STEPS];
-    int is_calibrated;
-    double rssi_distance_factor;
-
-    int rssi;
-    double distance;
-
-    double temperature;
-    int humidity;
+    uint8_t calibration_step;
+    uint8_t is_calibrated;
+    int16_t rssi_distance_factor; // 0.1 dBm, the RSSI at 1 m
 
-    // See the comment for NEIGHBOR_DISTANCES_LENGTH
-    char neighbor_distances[NEIGHBOR_DISTANCES_LENGTH];
+    int8_t rssi;
+    uint8_t humidity; // %
+    uint16_t distance; // dm, 0 until the first estimate
+    uint16_t filtered_distance; // cm
+    int16_t temperature; // 0.1 C
 
-    int proximity;
-    int light;
+    uint8_t neighbor_count;
+    struct neighbor_distance neighbor_distances[MAX_NODES];
 };
 
 typedef struct node_data node_data;
@@ -52,7 +65,10 @@ extern struct node_data self_node_data;
 
 extern int current_nodes;
 extern struct node_data neighbor_nodes_data[MAX_NODES];
-extern double average_node_temperature;
+extern int neighbor_order[MAX_NODES];
+extern int32_t average_node_temperature; // 0.01 C
+extern int self_proximity;
+extern uint32_t mesh_app_allocs;
 
 void initialize_app(void);
 int is_valid_calibration(int);
@@ -60,4 +76,8 @@ int calibrate_node(uint16_t, char*, int, int);
 void get_self_node_message(char*);
 void update_node_data(uint16_t, int, char*);
 void update_average_temperature(void);
-void get_mesh_summary(char* buffer);
\ No newline at end of file
+struct node_data *get_sorted_neighbor(int rank);
+void get_mesh_summary(char* buffer);
+void print_node_table(void);
+void print_ram_usage(void);
+void print_status_update(void);
\ No newline at end of file
@@ -7,8 +7,13 @@
 #include <zephyr.h>
 #include <drivers/gpio.h>
 #include <drivers/sensor.h>
+#include <drivers/adc.h>
+#include <hal/nrf_saadc.h>
 #include "board.h"
 #include "mesh.h"
+#include "power.h"
+#include "energy.h"
+#include "sim.h"
 
 #include <bluetooth/mesh.h>
 
@@ -26,6 +31,13 @@ static struct device_info dev_info[] = {
 
 int get_hdc1010_val(struct sensor_value *val)
 {
+	energy_count(ENERGY_FETCH_HDC1010);
+
+	if (MESH_SIM) {
+		sim_hdc1010_val(val);
+		return 0;
+	}
+
 	if (sensor_sample_fetch(dev_info[DEV_IDX_HDC1010].dev)) {
 		printk("Failed to fetch sample for device %s\n",
 		       dev_info[DEV_IDX_HDC1010].name);
@@ -47,6 +59,13 @@ int get_hdc1010_val(struct sensor_value *val)
 
 int get_mma8652_val(struct sensor_value *val)
 {
+	energy_count(ENERGY_FETCH_MMA8652);
+
+	if (MESH_SIM) {
+		sim_mma8652_val(val);
+		return 0;
+	}
+
 	if (sensor_sample_fetch(dev_info[DEV_IDX_MMA8652].dev)) {
 		printk("Failed to fetch sample for device %s\n",
 		       dev_info[DEV_IDX_MMA8652].name);
@@ -63,6 +82,13 @@ int get_mma8652_val(struct sensor_value *val)
 
 int get_apds9960_val(struct sensor_value *val)
 {
+	energy_count(ENERGY_FETCH_APDS9960);
+
+	if (MESH_SIM) {
+		sim_apds9960_val(val);
+		return 0;
+	}
+
 	if (sensor_sample_fetch(dev_info[DEV_IDX_APDS9960].dev)) {
 		printk("Failed to fetch sample for device %s\n",
 		       dev_info[DEV_IDX_APDS9960].name);
@@ -82,44 +108,58 @@ int get_apds9960_val(struct sensor_value *val)
 	return 0;
 }
 
-#define MOTION_TIMEOUT K_MINUTES(30)
+#define BATTERY_ADC_CHANNEL 0
+#define BATTERY_ADC_GAIN ADC_GAIN_1_6
+#define BATTERY_ADC_RESOLUTION 12
 
-static struct k_delayed_work motion_work;
+static const struct device *adc_dev;
 
-static void motion_timeout(struct k_work *work)
+/* Supply voltage straight from the SAADC, the cells feed VDD directly */
+int get_battery_mv(void)
 {
-	int err;
-
-	printk("power save\n");
+	int16_t sample;
+	int32_t mv;
+	struct adc_sequence sequence = {
+		.channels = BIT(BATTERY_ADC_CHANNEL),
+		.buffer = &sample,
+		.buffer_size = sizeof(sample),
+		.resolution = BATTERY_ADC_RESOLUTION,
+	};
 
-	if (!mesh_is_initialized()) {
-		k_delayed_work_submit(&motion_work, MOTION_TIMEOUT);
-		return;
+	if (!adc_dev || adc_read(adc_dev, &sequence)) {
+		return -1;
 	}
 
-	err = bt_mesh_suspend();
-	if (err && err != -EALREADY) {
-		printk("failed to suspend mesh (err %d)\n", err);
+	mv = sample;
+	if (adc_raw_to_millivolts(adc_ref_internal(adc_dev), BATTERY_ADC_GAIN,
+				  BATTERY_ADC_RESOLUTION, &mv)) {
+		return -1;
 	}
+
+	return mv;
 }
 
-static void motion_handler(const struct device *dev,
-			   struct sensor_trigger *trig)
+static void configure_battery(void)
 {
-	int err;
-
-	printk("motion!\n");
-
-	if (!mesh_is_initialized()) {
-		return;
-	}
+	const struct adc_channel_cfg cfg = {
+		.gain = BATTERY_ADC_GAIN,
+		.reference = ADC_REF_INTERNAL,
+		.acquisition_time = ADC_ACQ_TIME(ADC_ACQ_TIME_MICROSECONDS, 40),
+		.channel_id = BATTERY_ADC_CHANNEL,
+		.input_positive = NRF_SAADC_INPUT_VDD,
+	};
 
-	err = bt_mesh_resume();
-	if (err && err != -EALREADY) {
-		printk("failed to resume mesh (err %d)\n", err);
+	adc_dev = device_get_binding(DT_LABEL(DT_NODELABEL(adc)));
+	if (!adc_dev || adc_channel_setup(adc_dev, &cfg)) {
+		printk("Battery measurement not available\n");
+		adc_dev = NULL;
 	}
+}
 
-	k_delayed_work_submit(&motion_work, MOTION_TIMEOUT);
+static void motion_handler(const struct device *dev,
+			   struct sensor_trigger *trig)
+{
+	power_motion();
 }
 
 static void configure_accel(void)
@@ -134,20 +174,19 @@ static void configure_accel(void)
 	err = sensor_trigger_set(accel->dev, &trig_motion, motion_handler);
 	if (err) {
 		printk("setting motion trigger failed, err %d\n", err);
-		return;
 	}
-
-
-	k_delayed_work_init(&motion_work, motion_timeout);
-	k_delayed_work_submit(&motion_work, MOTION_TIMEOUT);
 }
 
 int periphs_init(void)
 {
 	unsigned int i;
 
-	/* Bind sensors */
+	/* Bind sensors, the simulation only needs the display */
 	for (i = 0U; i < ARRAY_SIZE(dev_info); i++) {
+		if (MESH_SIM && i != DEV_IDX_EPD) {
+			continue;
+		}
+
 		dev_info[i].dev = device_get_binding(dev_info[i].name);
 		if (dev_info[i].dev == NULL) {
 			printk("Failed to get %s device\n", dev_info[i].name);
@@ -155,7 +194,11 @@ int periphs_init(void)
 		}
 	}
 
-	configure_accel();
+	if (!MESH_SIM) {
+		configure_accel();
+	}
+
+	configure_battery();
 
 	return 0;
 }
@@ -0,0 +1,236 @@
+/*
+ * Graded power levels. A badge that is carried around samples and publishes
+ * at full rate. Once it lies still it steps down to slower sampling, longer
+ * heartbeat periods and fewer redraws, but stays in the mesh so it can still
+ * be reached. Busy neighborhoods hold it one level up, a weak battery takes
+ * it out of relaying, and only an empty battery suspends the mesh.
+ *
+ * Motion raises the level right away, every step down waits for its timeout.
+ */
+
+#include <zephyr.h>
+#include <sys/printk.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/mesh.h>
+#include <drivers/sensor.h>
+
+#include "mesh.h"
+#include "board.h"
+#include "relay_ctl.h"
+#include "power.h"
+#include "tune.h"
+
+#define POWER_EVAL_INTERVAL_MS	(30 * MSEC_PER_SEC)
+
+/* Still for this long, the badge was put down */
+#define IDLE_TIMEOUT_MS		(2 * 60 * MSEC_PER_SEC)
+/* Still for this long, the badge isn't coming back soon */
+#define STATIONARY_TIMEOUT_MS	(30 * 60 * MSEC_PER_SEC)
+
+/* New heartbeats per evaluation interval that keep a still badge idle */
+#define NEIGHBOR_BUSY_MSGS	6
+
+#define BATTERY_LOW_MV		2500
+#define BATTERY_CRITICAL_MV	2200
+#define BATTERY_HYSTERESIS_MV	100
+
+struct power_policy {
+	const char *name;
+	uint32_t sensor_interval_ms;
+	uint8_t heartbeat_period_sec;
+	/* Shortest time between redraws, 0 redraws on the button only */
+	uint32_t display_interval_ms;
+	bool relay;
+};
+
+/* The active level is tuned at runtime, the others scale with it */
+static const struct power_policy policies[POWER_LEVEL_COUNT] = {
+	[POWER_ACTIVE] = { "active", 1000, HEARTBEAT_PERIOD_SEC, 1000, true },
+	[POWER_IDLE] = { "idle", 5000, 20, 5000, true },
+	[POWER_STATIONARY] = { "stationary", 30000, 60, 60000, true },
+	[POWER_LOW_BATTERY] = { "low battery", 60000, 120, 0, false },
+	[POWER_SUSPENDED] = { "suspended", 0, 120, 0, false },
+};
+
+static enum power_level level = POWER_ACTIVE;
+static uint32_t last_motion;
+static atomic_t neighbor_msgs;
+static int battery_mv;
+
+static struct k_delayed_work eval_work;
+
+void power_motion(void)
+{
+	last_motion = k_uptime_get_32();
+
+	if (level != POWER_ACTIVE) {
+		k_delayed_work_submit(&eval_work, K_NO_WAIT);
+	}
+}
+
+void power_neighbor_rx(void)
+{
+	atomic_inc(&neighbor_msgs);
+}
+
+enum power_level power_level_get(void)
+{
+	return level;
+}
+
+static enum power_level battery_level(void)
+{
+	/* Only the threshold of the level being left moves up */
+	int critical = BATTERY_CRITICAL_MV +
+		       (level == POWER_SUSPENDED ? BATTERY_HYSTERESIS_MV : 0);
+	int low = BATTERY_LOW_MV +
+		  (level >= POWER_LOW_BATTERY ? BATTERY_HYSTERESIS_MV : 0);
+
+	/* Not measured, the board runs from USB or a regulator */
+	if (battery_mv <= 0) {
+		return POWER_ACTIVE;
+	}
+
+	if (battery_mv < critical) {
+		return POWER_SUSPENDED;
+	}
+
+	if (battery_mv < low) {
+		return POWER_LOW_BATTERY;
+	}
+
+	return POWER_ACTIVE;
+}
+
+static enum power_level level_decide(uint32_t msgs)
+{
+	uint32_t still = k_uptime_get_32() - last_motion;
+	enum power_level lowest = battery_level();
+
+	if (lowest != POWER_ACTIVE) {
+		return lowest;
+	}
+
+	if (still < IDLE_TIMEOUT_MS) {
+		return POWER_ACTIVE;
+	}
+
+	if (still < STATIONARY_TIMEOUT_MS || msgs >= NEIGHBOR_BUSY_MSGS) {
+		return POWER_IDLE;
+	}
+
+	return POWER_STATIONARY;
+}
+
+static uint32_t scale(uint32_t val, uint32_t tuned, uint32_t active)
+{
+	return (uint64_t)val * tuned / active;
+}
+
+static uint8_t heartbeat_period(enum power_level l)
+{
+	return MIN(scale(policies[l].heartbeat_period_sec, tune.heartbeat_sec,
+			 HEARTBEAT_PERIOD_SEC), UINT8_MAX);
+}
+
+static void intervals_apply(enum power_level l)
+{
+	const struct power_policy *p = &policies[l];
+	const struct power_policy *active = &policies[POWER_ACTIVE];
+
+	board_set_sensor_interval(scale(p->sensor_interval_ms,
+					tune.sensor_interval_ms,
+					active->sensor_interval_ms));
+	board_set_display_interval(scale(p->display_interval_ms,
+					 tune.display_interval_ms,
+					 active->display_interval_ms));
+}
+
+static void level_apply(enum power_level next)
+{
+	const struct power_policy *p = &policies[next];
+	int err;
+
+	printk("Power level %s\n", p->name);
+
+	if (level == POWER_SUSPENDED && next != POWER_SUSPENDED) {
+		err = bt_mesh_resume();
+		if (err && err != -EALREADY) {
+			printk("failed to resume mesh (err %d)\n", err);
+		}
+
+		board_refresh_display();
+	}
+
+	intervals_apply(next);
+
+	if (next == POWER_SUSPENDED && level != POWER_SUSPENDED) {
+		/* The e-paper keeps showing it without power */
+		board_show_text("Battery empty", true, K_FOREVER);
+
+		err = bt_mesh_suspend();
+		if (err && err != -EALREADY) {
+			printk("failed to suspend mesh (err %d)\n", err);
+		}
+	}
+
+	level = next;
+}
+
+static void eval(struct k_work *work)
+{
+	uint32_t msgs = atomic_set(&neighbor_msgs, 0);
+	enum power_level next;
+	int mv;
+
+	mv = get_battery_mv();
+	if (mv > 0) {
+		battery_mv = mv;
+	}
+
+	next = level_decide(msgs);
+
+	if (next != level) {
+		level_apply(next);
+	}
+
+	/* Cheap to repeat, and the node may have been configured since */
+	if (mesh_is_configured()) {
+		mesh_heartbeat_period_set(heartbeat_period(level));
+		relay_ctl_allow(policies[level].relay);
+	}
+
+	k_delayed_work_submit(&eval_work, K_MSEC(POWER_EVAL_INTERVAL_MS));
+}
+
+void power_retune(void)
+{
+	if (level != POWER_SUSPENDED) {
+		intervals_apply(level);
+	}
+
+	k_delayed_work_submit(&eval_work, K_NO_WAIT);
+}
+
+void power_print(void)
+{
+	const struct power_policy *p = &policies[level];
+
+	printk("Power level %s: sensors %u ms, heartbeat %u s, relay %s,"
+	       " battery %d mV\n", p->name,
+	       scale(p->sensor_interval_ms, tune.sensor_interval_ms,
+		     policies[POWER_ACTIVE].sensor_interval_ms),
+	       heartbeat_period(level), p->relay ? "allowed" : "off",
+	       battery_mv);
+}
+
+int power_init(void)
+{
+	last_motion = k_uptime_get_32();
+
+	k_delayed_work_init(&eval_work, eval);
+	k_delayed_work_submit(&eval_work, K_MSEC(POWER_EVAL_INTERVAL_MS));
+
+	return 0;
+}
@@ -0,0 +1,22 @@
+/*
+ * Graded power levels. Motion, neighbor activity and the battery voltage
+ * pick a level, and each level sets the sensor sampling interval, the
+ * heartbeat period, the display refresh policy and relay participation.
+ */
+
+enum power_level {
+	POWER_ACTIVE,
+	POWER_IDLE,
+	POWER_STATIONARY,
+	POWER_LOW_BATTERY,
+	POWER_SUSPENDED,
+	POWER_LEVEL_COUNT,
+};
+
+void power_motion(void);
+void power_neighbor_rx(void);
+enum power_level power_level_get(void);
+/* The active level settings changed, see tune.h */
+void power_retune(void);
+void power_print(void);
+int power_init(void);
@@ -8,7 +8,6 @@
 #include <zephyr.h>
 #include <device.h>
 #include <drivers/gpio.h>
-#include <display/cfb.h>
 #include <sys/printk.h>
 #include <drivers/flash.h>
 #include <storage/flash_map.h>
@@ -24,46 +23,72 @@
 #include "mesh.h"
 #include "board.h"
 #include "mesh_app.h"
-
-enum font_size {
-	FONT_SMALL = 0,
-	FONT_MEDIUM = 1,
-	FONT_BIG = 2,
-};
+#include "app_log.h"
+#include "epd.h"
+#include "link_quality.h"
+#include "gateway.h"
+#include "energy.h"
+#include "trace.h"
+#include "fmt.h"
 
 enum screen_ids {
 	SCREEN_MAIN = 0,
 	MY_SCREEN = 1,
 	SCREEN_SENSORS = 2,
 	SCREEN_STATS = 3,
+	SCREEN_ENERGY = 4,
 	SCREEN_LAST,
 };
 
-struct font_info {
-	uint8_t columns;
-} fonts[] = {
-	[FONT_BIG] =    { .columns = 12 },
-	[FONT_MEDIUM] = { .columns = 16 },
-	[FONT_SMALL] =  { .columns = 25 },
-};
-
 #define LONG_PRESS_TIMEOUT K_SECONDS(0.5)
-#define SENSOR_VALUES_REFRESH_INTERVAL K_SECONDS(1)
+#define DOUBLE_PRESS_MS 500
+
+/* Power of two, the table is open addressed by a hash of the address */
+#define STAT_COUNT CONFIG_APP_STAT_COUNT
+#define TOP_COUNT 4
 
-#define STAT_COUNT 128
+#define TOP_NONE -1
+
+BUILD_ASSERT((STAT_COUNT & (STAT_COUNT - 1)) == 0,
+	     "STAT_COUNT must be a power of two");
 
 static const struct device *display_dev;
+/* Set by the power level, see power.c */
+static uint32_t sensor_interval_ms = 1000;
+/* Shortest time between two redraws of the current screen, 0 for none */
+static uint32_t display_interval_ms = 1000;
 static bool pressed;
 static uint8_t screen_id = SCREEN_MAIN;
 static const struct device *gpio;
 static struct k_delayed_work display_work;
 static struct k_delayed_work long_press_work;
 static struct k_delayed_work sensor_values_work;
+static struct k_work log_level_work;
+static struct k_work gateway_toggle_work;
+static struct k_delayed_work snapshot_work;
 static char str_buf[256];
 static int proximity;
 static int light;
-static double temperature;
+/* 0.01 C */
+static int32_t temperature;
 static int humidity;
+static struct sensor_value accel[3];
+
+/* Models each screen renders, see board_model_changed() */
+static const uint32_t screen_models[SCREEN_LAST] = {
+	[SCREEN_MAIN] = 0,
+	[MY_SCREEN] = BIT(BOARD_MODEL_NODES) | BIT(BOARD_MODEL_AVERAGE),
+	[SCREEN_SENSORS] = BIT(BOARD_MODEL_SENSORS),
+	[SCREEN_STATS] = BIT(BOARD_MODEL_STATS),
+	[SCREEN_ENERGY] = BIT(BOARD_MODEL_ENERGY),
+};
+
+static atomic_t model_gen[BOARD_MODEL_COUNT];
+static atomic_val_t drawn_gen[BOARD_MODEL_COUNT];
+static int64_t display_ts;
+static bool display_scheduled;
+static bool display_forced = true;
+static bool text_shown;
 
 static struct {
 	const struct device *dev;
@@ -84,40 +109,12 @@ static struct {
 
 struct k_delayed_work led_timer;
 
-static size_t print_line(enum font_size font_size, int row, const char *text,
-			 size_t len, bool center)
-{
-	uint8_t font_height, font_width;
-	uint8_t line[fonts[FONT_SMALL].columns + 1];
-	int pad;
-
-	cfb_framebuffer_set_font(display_dev, font_size);
-
-	len = MIN(len, fonts[font_size].columns);
-	memcpy(line, text, len);
-	line[len] = '\0';
-
-	if (center) {
-		pad = (fonts[font_size].columns - len) / 2U;
-	} else {
-		pad = 0;
-	}
-
-	cfb_get_font_size(display_dev, font_size, &font_width, &font_height);
-
-	if (cfb_print(display_dev, line, font_width * pad, font_height * row)) {
-		printk("Failed to print a string\n");
-	}
-
-	return len;
-}
-
 static size_t get_len(enum font_size font, const char *text)
 {
 	const char *space = NULL;
 	size_t i;
 
-	for (i = 0; i <= fonts[font].columns; i++) {
+	for (i = 0; i <= epd_columns(font); i++) {
 		switch (text[i]) {
 		case '\n':
 		case '\0':
@@ -137,7 +134,7 @@ static size_t get_len(enum font_size font, const char *text)
 		return space - text;
 	}
 
-	return fonts[font].columns;
+	return epd_columns(font);
 }
 
 void board_blink_leds(void)
@@ -149,8 +146,6 @@ void board_show_text(const char *text, bool center, k_timeout_t duration)
 {
 	int i;
 
-	cfb_framebuffer_clear(display_dev, false);
-
 	for (i = 0; i < 3; i++) {
 		size_t len;
 
@@ -163,19 +158,55 @@ void board_show_text(const char *text, bool center, k_timeout_t duration)
 			break;
 		}
 
-		text += print_line(FONT_BIG, i, text, len, center);
+		text += epd_print_line(FONT_BIG, i, text, len, center);
 		if (!*text) {
 			break;
 		}
 	}
 
-	cfb_framebuffer_finalize(display_dev);
+	epd_commit();
+
+	/* Model changes must not draw over the text while it is shown */
+	text_shown = true;
 
 	if (!K_TIMEOUT_EQ(duration, K_FOREVER)) {
+		display_scheduled = true;
 		k_delayed_work_submit(&display_work, duration);
 	}
 }
 
+void board_model_changed(enum board_model model)
+{
+	int64_t wait;
+
+	atomic_inc(&model_gen[model]);
+
+	if (!(screen_models[screen_id] & BIT(model)) || text_shown ||
+	    display_scheduled || !display_interval_ms) {
+		return;
+	}
+
+	/* Coalesce the changes into one redraw per minimum interval */
+	wait = display_interval_ms - (k_uptime_get() - display_ts);
+
+	display_scheduled = true;
+	k_delayed_work_submit(&display_work, K_MSEC(MAX(wait, 0)));
+}
+
+static bool screen_is_stale(void)
+{
+	int i;
+
+	for (i = 0; i < BOARD_MODEL_COUNT; i++) {
+		if ((screen_models[screen_id] & BIT(i)) &&
+		    atomic_get(&model_gen[i]) != drawn_gen[i]) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
 static struct stat {
 	uint16_t addr;
 	char name[9];
@@ -183,78 +214,183 @@ static struct stat {
 	uint8_t max_hops;
 	uint16_t hello_count;
 	uint16_t heartbeat_count;
+	struct link_quality link;
+	/* Position in the top senders heap, or TOP_NONE */
+	int8_t top_pos;
 } stats[STAT_COUNT] = {
 	[0 ... (STAT_COUNT - 1)] = {
 		.min_hops = BT_MESH_TTL_MAX,
 		.max_hops = 0,
+		.top_pos = TOP_NONE,
 	},
 };
 
 static uint32_t stat_count;
 
+/* Min-heap of the TOP_COUNT most active senders, least active at the root */
+static uint16_t top[TOP_COUNT];
+static uint8_t top_count;
+
 #define NO_UPDATE -1
 
-static int add_hello(uint16_t addr, const char *name)
+static uint32_t stat_messages(const struct stat *stat)
 {
-	int i;
+	return stat->hello_count + stat->heartbeat_count;
+}
 
-	for (i = 0; i < ARRAY_SIZE(stats); i++) {
+/* Find the entry of an address, claiming a free slot for a new one */
+static int get_stat(uint16_t addr)
+{
+	uint32_t i = (((uint32_t)addr * 2654435761U) >> 16) & (STAT_COUNT - 1);
+	int probes;
+
+	for (probes = 0; probes < STAT_COUNT; probes++) {
 		struct stat *stat = &stats[i];
 
+		if (stat->addr == addr) {
+			return i;
+		}
+
 		if (!stat->addr) {
 			stat->addr = addr;
-			strncpy(stat->name, name, sizeof(stat->name) - 1);
-			stat->hello_count = 1U;
 			stat_count++;
 			return i;
 		}
 
-		if (stat->addr == addr) {
-			/* Update name, incase it has changed */
-			strncpy(stat->name, name, sizeof(stat->name) - 1);
+		i = (i + 1) & (STAT_COUNT - 1);
+	}
 
-			if (stat->hello_count < 0xffff) {
-				stat->hello_count++;
-				return i;
-			}
+	return NO_UPDATE;
+}
+
+static bool top_less(int a, int b)
+{
+	return stat_messages(&stats[top[a]]) < stat_messages(&stats[top[b]]);
+}
+
+static void top_swap(int a, int b)
+{
+	uint16_t tmp = top[a];
+
+	top[a] = top[b];
+	top[b] = tmp;
+
+	stats[top[a]].top_pos = a;
+	stats[top[b]].top_pos = b;
+}
+
+static void top_sift_up(int pos)
+{
+	while (pos > 0 && top_less(pos, (pos - 1) / 2)) {
+		top_swap(pos, (pos - 1) / 2);
+		pos = (pos - 1) / 2;
+	}
+}
 
-			return NO_UPDATE;
+static void top_sift_down(int pos)
+{
+	while (1) {
+		int left = 2 * pos + 1;
+		int right = left + 1;
+		int min = pos;
+
+		if (left < top_count && top_less(left, min)) {
+			min = left;
 		}
+
+		if (right < top_count && top_less(right, min)) {
+			min = right;
+		}
+
+		if (min == pos) {
+			return;
+		}
+
+		top_swap(pos, min);
+		pos = min;
+	}
+}
+
+/* Called after the message count of a sender went up */
+static void update_top(int i)
+{
+	struct stat *stat = &stats[i];
+
+	if (stat->top_pos != TOP_NONE) {
+		top_sift_down(stat->top_pos);
+		return;
+	}
+
+	if (top_count < TOP_COUNT) {
+		top[top_count] = i;
+		stat->top_pos = top_count;
+		top_sift_up(top_count++);
+		return;
+	}
+
+	if (stat_messages(stat) <= stat_messages(&stats[top[0]])) {
+		return;
+	}
+
+	/* Replace the least active of the top senders */
+	stats[top[0]].top_pos = TOP_NONE;
+	top[0] = i;
+	stat->top_pos = 0;
+	top_sift_down(0);
+}
+
+static int add_hello(uint16_t addr, const char *name)
+{
+	struct stat *stat;
+	int i;
+
+	i = get_stat(addr);
+	if (i == NO_UPDATE) {
+		return NO_UPDATE;
+	}
+
+	stat = &stats[i];
+
+	/* Update name, incase it has changed */
+	strncpy(stat->name, name, sizeof(stat->name) - 1);
+
+	if (stat->hello_count < 0xffff) {
+		stat->hello_count++;
+		update_top(i);
+		return i;
 	}
 
 	return NO_UPDATE;
 }
 
-static int add_heartbeat(uint16_t addr, uint8_t hops)
+static int add_heartbeat(uint16_t addr, uint8_t hops, uint16_t seq,
+			 int8_t rssi, uint8_t period)
 {
+	struct stat *stat;
 	int i;
 
-	for (i = 0; i < ARRAY_SIZE(stats); i++) {
-		struct stat *stat = &stats[i];
+	i = get_stat(addr);
+	if (i == NO_UPDATE) {
+		return NO_UPDATE;
+	}
 
-		if (!stat->addr) {
-			stat->addr = addr;
-			stat->heartbeat_count = 1U;
-			stat->min_hops = hops;
-			stat->max_hops = hops;
-			stat_count++;
-			return i;
-		}
+	stat = &stats[i];
 
-		if (stat->addr == addr) {
-			if (hops < stat->min_hops) {
-				stat->min_hops = hops;
-			} else if (hops > stat->max_hops) {
-				stat->max_hops = hops;
-			}
+	if (hops < stat->min_hops) {
+		stat->min_hops = hops;
+	}
 
-			if (stat->heartbeat_count < 0xffff) {
-				stat->heartbeat_count++;
-				return i;
-			}
+	if (hops > stat->max_hops) {
+		stat->max_hops = hops;
+	}
 
-			return NO_UPDATE;
-		}
+	link_quality_update(&stat->link, seq, hops, rssi, k_uptime_get_32(),
+			    period);
+
+	if (stat->heartbeat_count < 0xffff) {
+		stat->heartbeat_count++;
+		update_top(i);
+		return i;
 	}
 
 	return NO_UPDATE;
@@ -266,90 +402,168 @@ void board_add_hello(uint16_t addr, const char *name)
 
 	sort_i = add_hello(addr, name);
 	if (sort_i != NO_UPDATE) {
+		board_model_changed(BOARD_MODEL_STATS);
 	}
 }
 
-void board_add_heartbeat(uint16_t addr, uint8_t hops)
+void board_add_heartbeat(uint16_t addr, uint8_t hops, uint16_t seq,
+			 int8_t rssi, uint8_t period)
 {
 	uint32_t sort_i;
 
-	sort_i = add_heartbeat(addr, hops);
+	sort_i = add_heartbeat(addr, hops, seq, rssi, period);
 	if (sort_i != NO_UPDATE) {
+		board_model_changed(BOARD_MODEL_STATS);
+	}
+}
+
+void board_reject_heartbeat(uint16_t addr, bool stale)
+{
+	int i;
+
+	i = get_stat(addr);
+	if (i != NO_UPDATE) {
+		link_quality_reject(&stats[i].link, stale);
+	}
+}
+
+void board_link_totals(uint32_t *received, uint32_t *expected)
+{
+	int i;
+
+	*received = 0U;
+	*expected = 0U;
+
+	for (i = 0; i < ARRAY_SIZE(stats); i++) {
+		*received += stats[i].link.received;
+		*expected += stats[i].link.expected;
+	}
+}
+
+void board_link_rejects(uint32_t *duplicates, uint32_t *stale)
+{
+	int i;
+
+	*duplicates = 0U;
+	*stale = 0U;
+
+	for (i = 0; i < ARRAY_SIZE(stats); i++) {
+		*duplicates += stats[i].link.duplicates;
+		*stale += stats[i].link.stale;
+	}
+}
+
+uint32_t board_sender_count(void)
+{
+	return stat_count;
+}
+
+void board_print_link_stats(void)
+{
+	uint32_t now = k_uptime_get_32();
+	int i, j;
+
+	printk("Link quality:\n");
+
+	for (i = 0; i < ARRAY_SIZE(stats); i++) {
+		struct link_quality *lq = &stats[i].link;
+		uint16_t loss;
+
+		if (!stats[i].addr || !lq->received) {
+			continue;
+		}
+
+		loss = link_quality_loss(lq, now);
+
+		printk("0x%04x rx %u/%u loss %u.%u%% dup %u stale %u"
+		       " jitter %u ms rssi %d/%d/%d hops",
+		       stats[i].addr, lq->received, lq->expected,
+		       loss / 10U, loss % 10U, lq->duplicates, lq->stale,
+		       lq->jitter,
+		       link_quality_rssi_percentile(lq, 10),
+		       link_quality_rssi_percentile(lq, 50),
+		       link_quality_rssi_percentile(lq, 90));
+
+		for (j = 0; j < LINK_HOP_BUCKETS; j++) {
+			printk(" %u", lq->hops[j]);
+		}
+
+		printk("\n");
 	}
 }
 
 static void show_statistics(void)
 {
-	int top[4] = { -1, -1, -1, -1 };
+	uint16_t order[TOP_COUNT];
 	int len, i, line = 0;
 	struct stat *stat;
 	char str[32];
 
-	cfb_framebuffer_clear(display_dev, false);
-
 	len = snprintk(str, sizeof(str),
 		       "Own Address: 0x%04x", mesh_get_addr());
 	
-	print_line(FONT_SMALL, line++, str, len, false);
+	epd_print_line(FONT_SMALL, line++, str, len, false);
 
-	len = snprintk(str, sizeof(str),
-		       "Node Count:  %u", stat_count + 1);
-	print_line(FONT_SMALL, line++, str, len, false);
+	if (MESH_TRACE) {
+		char p50[3][6];
+		int hop;
 
-	/* Find the top sender */
-	for (i = 0; i < ARRAY_SIZE(stats); i++) {
-		int j;
-
-		stat = &stats[i];
-		if (!stat->addr) {
-			break;
+		/* Median heartbeat latency over one, two and three hops */
+		for (hop = 0; hop < ARRAY_SIZE(p50); hop++) {
+			trace_latency_str(trace_percentile(trace_hop_hist(hop + 1),
+							   50),
+					  p50[hop], sizeof(p50[hop]));
 		}
 
-		if (!stat->hello_count) {
-			continue;
-		}
-
-		for (j = 0; j < ARRAY_SIZE(top); j++) {
-			if (top[j] < 0) {
-				top[j] = i;
-				break;
-			}
-
-			if (stat->hello_count <= stats[top[j]].hello_count) {
-				continue;
-			}
+		len = snprintk(str, sizeof(str), "Nodes %u p50 %s/%s/%s ms",
+			       stat_count + 1, p50[0], p50[1], p50[2]);
+	} else {
+		len = snprintk(str, sizeof(str),
+			       "Node Count:  %u", stat_count + 1);
+	}
+	epd_print_line(FONT_SMALL, line++, str, len, false);
 
-			/* Move other elements down the list */
-			if (j < ARRAY_SIZE(top) - 1) {
-				memmove(&top[j + 1], &top[j],
-					((ARRAY_SIZE(top) - j - 1) *
-					 sizeof(top[j])));
-			}
+	/* The heap only keeps the top senders, order those few for display */
+	for (i = 0; i < top_count; i++) {
+		int j;
 
-			top[j] = i;
-			break;
+		for (j = i; j > 0 && stat_messages(&stats[top[i]]) >
+		     stat_messages(&stats[order[j - 1]]); j--) {
+			order[j] = order[j - 1];
 		}
+
+		order[j] = top[i];
 	}
 
 	if (stat_count > 0) {
-		len = snprintk(str, sizeof(str), "Most messages from:");
-		print_line(FONT_SMALL, line++, str, len, false);
+		uint32_t now = k_uptime_get_32();
 
-		for (i = 0; i < ARRAY_SIZE(top); i++) {
-			if (top[i] < 0) {
-				break;
-			}
+		len = snprintk(str, sizeof(str), "Top  msgs loss jit rssi");
+		epd_print_line(FONT_SMALL, line++, str, len, false);
 
-			stat = &stats[top[i]];
+		for (i = 0; i < top_count; i++) {
+			stat = &stats[order[i]];
 
-			len = snprintk(str, sizeof(str), "%-3u 0x%04x %s",
-				       stat->hello_count, stat->addr,
-				       stat->name);
-			print_line(FONT_SMALL, line++, str, len, false);
+			len = snprintk(str, sizeof(str), "%04x %4u %3u%% %3u %d",
+				       stat->addr, stat_messages(stat),
+				       link_quality_loss(&stat->link, now) / 10U,
+				       MIN(stat->link.jitter, 999),
+				       link_quality_rssi_percentile(&stat->link, 50));
+			epd_print_line(FONT_SMALL, line++, str, len, false);
 		}
 	}
 
-	cfb_framebuffer_finalize(display_dev);
+	epd_commit();
+}
+
+/* A sensor value times scale, rounded half away from zero */
+static int32_t sensor_value_to_fixed(const struct sensor_value *val,
+				     int32_t scale)
+{
+	int32_t div = 1000000 / scale;
+	int32_t frac = val->val2 + (val->val2 < 0 ? -div / 2 : div / 2);
+
+	return val->val1 * scale + frac / div;
 }
 
 static int update_hdc1010_values()
@@ -364,7 +578,7 @@ static int update_hdc1010_values()
 	}
 	else
 	{
-		temperature = sensor_value_to_double(&val[0]);
+		temperature = sensor_value_to_fixed(&val[0], 100);
 		humidity = val[1].val1;
 
 		return 0;
@@ -390,63 +604,84 @@ static int update_apds9960_values()
 	}
 }
 
-static void show_sensors_data(k_timeout_t interval)
+static void show_sensors_data(void)
 {
-	struct sensor_value val[3];
+	static const char *const axes[] = { "AX :", "AY :", "AZ :" };
 	uint8_t line = 0U;
 	uint16_t len = 0U;
-
-	cfb_framebuffer_clear(display_dev, false);
+	char *end;
+	int i;
 
 	/* hdc1010 */
-	if (update_hdc1010_values()) 
-	{
-		goto _error_get;
-	}
-
-	len = snprintf(str_buf, sizeof(str_buf), "Temperature:%.2f C\n", temperature);
-	print_line(FONT_SMALL, line++, str_buf, len, false);
+	end = fmt_str(str_buf, "Temperature:");
+	end = fmt_fixed(end, temperature, 2, 0);
+	end = fmt_str(end, " C\n");
+	epd_print_line(FONT_SMALL, line++, str_buf, end - str_buf, false);
 
 	len = snprintf(str_buf, sizeof(str_buf), "Humidity:%d%%\n", humidity);
-	print_line(FONT_SMALL, line++, str_buf, len, false);
+	epd_print_line(FONT_SMALL, line++, str_buf, len, false);
 
 	/* mma8652 */
-	if (get_mma8652_val(val)) 
-	{
-		goto _error_get;
+	for (i = 0; i < ARRAY_SIZE(accel); i++) {
+		end = fmt_str(str_buf, axes[i]);
+		end = fmt_fixed(end, sensor_value_to_fixed(&accel[i], 1000),
+				3, 10);
+		end = fmt_str(end, "\n");
+		epd_print_line(FONT_SMALL, line++, str_buf, end - str_buf,
+			       false);
 	}
 
-	len = snprintf(str_buf, sizeof(str_buf), "AX :%10.3f\n",
-		       sensor_value_to_double(&val[0]));
-	print_line(FONT_SMALL, line++, str_buf, len, false);
-
-	len = snprintf(str_buf, sizeof(str_buf), "AY :%10.3f\n",
-		       sensor_value_to_double(&val[1]));
-	print_line(FONT_SMALL, line++, str_buf, len, false);
-
-	len = snprintf(str_buf, sizeof(str_buf), "AZ :%10.3f\n",
-		       sensor_value_to_double(&val[2]));
-	print_line(FONT_SMALL, line++, str_buf, len, false);
-
 	/* apds9960 */
-	if (update_apds9960_values()) 
-	{
-		goto _error_get;
-	}
-
 	len = snprintf(str_buf, sizeof(str_buf), "Light :%d\n", light);
-	print_line(FONT_SMALL, line++, str_buf, len, false);
+	epd_print_line(FONT_SMALL, line++, str_buf, len, false);
 	len = snprintf(str_buf, sizeof(str_buf), "Proximity:%d\n", proximity);
-	print_line(FONT_SMALL, line++, str_buf, len, false);
+	epd_print_line(FONT_SMALL, line++, str_buf, len, false);
 
-	cfb_framebuffer_finalize(display_dev);
+	epd_commit();
+}
 
-	k_delayed_work_submit(&display_work, interval);
+static void energy_line(int line, const char *label, uint32_t count,
+			uint32_t uah)
+{
+	int len;
 
-	return;
+	len = snprintk(str_buf, sizeof(str_buf), "%-8s%7u %4u.%03u", label,
+		       count, uah / 1000U, uah % 1000U);
+	epd_print_line(FONT_SMALL, line, str_buf, len, false);
+}
 
-	_error_get:
-		printk("Failed to get sensor data or print a string\n");
+static void show_energy(void)
+{
+	static struct energy_report r;
+	struct energy_counter *e = r.events;
+	uint32_t *uah = r.event_uah;
+	uint32_t minutes;
+	int len;
+
+	energy_report(&r);
+
+	minutes = r.uptime_ms / (60U * MSEC_PER_SEC);
+	len = snprintk(str_buf, sizeof(str_buf), "%u.%03u mAh in %uh%02um",
+		       r.total_uah / 1000U, r.total_uah % 1000U, minutes / 60U,
+		       minutes % 60U);
+	epd_print_line(FONT_SMALL, 0, str_buf, len, false);
+
+	energy_line(1, "rx s", r.radio_rx_ms / MSEC_PER_SEC, r.radio_rx_uah);
+	energy_line(2, "tx", e[ENERGY_TX_UNSEG].count + e[ENERGY_TX_SEG].count,
+		    uah[ENERGY_TX_UNSEG] + uah[ENERGY_TX_SEG]);
+	energy_line(3, "relay", e[ENERGY_RELAY].count, uah[ENERGY_RELAY]);
+	energy_line(4, "sensors",
+		    e[ENERGY_FETCH_HDC1010].count +
+		    e[ENERGY_FETCH_MMA8652].count +
+		    e[ENERGY_FETCH_APDS9960].count,
+		    uah[ENERGY_FETCH_HDC1010] + uah[ENERGY_FETCH_MMA8652] +
+		    uah[ENERGY_FETCH_APDS9960]);
+	energy_line(5, "epd",
+		    e[ENERGY_EPD_FULL].count + e[ENERGY_EPD_PARTIAL].count,
+		    uah[ENERGY_EPD_FULL] + uah[ENERGY_EPD_PARTIAL]);
+	energy_line(6, "work ms", r.work_ms, r.work_uah);
+
+	epd_commit();
 }
 
 static void show_main(void)
@@ -476,35 +711,58 @@ static void show_main(void)
 #define OP_HA		   0xbe
 #define DEFAULT_TTL       31
 
-static void my_data(k_timeout_t interval)
+/* Rows 1 to 5, between the own address and the average temperature */
+#define NEIGHBORS_PER_PAGE 5
+
+static int neighbor_page;
+
+static void my_data(void)
 {
 	uint8_t line = 0U;
 	uint16_t len = 0U;
+	int pages, first, rank;
+	char *end;
 
-	cfb_framebuffer_clear(display_dev, true);
+	pages = MAX(1, (current_nodes + NEIGHBORS_PER_PAGE - 1) / NEIGHBORS_PER_PAGE);
+
+	/* The list may have shrunk since the page was selected */
+	if (neighbor_page >= pages) {
+		neighbor_page = 0;
+	}
 
 	const char* bluetooth_name = get_bluetooth_name();
 
-	len = snprintf(str_buf, sizeof(str_buf), "*%s @%04x\n", bluetooth_name, mesh_get_addr());
-	print_line(FONT_SMALL, line++, str_buf, len, false);
+	len = snprintf(str_buf, sizeof(str_buf), "*%s @%04x %d/%d\n", bluetooth_name,
+		       mesh_get_addr(), neighbor_page + 1, pages);
+	epd_print_line(FONT_SMALL, line++, str_buf, len, false);
 
-	for (int i = 0; i < current_nodes; i++)
-	{
-		len = snprintf(str_buf, sizeof(str_buf), "%s @%04x S:%d D:%.2f\n", 
-			neighbor_nodes_data[i].name, neighbor_nodes_data[i].address, 
-			neighbor_nodes_data[i].rssi, neighbor_nodes_data[i].distance);
+	/* Nearest first, see update_neighbor_order() */
+	first = neighbor_page * NEIGHBORS_PER_PAGE;
 
-		print_line(FONT_SMALL, line++, str_buf, len, false);
+	for (rank = first; rank < MIN(current_nodes, first + NEIGHBORS_PER_PAGE); rank++)
+	{
+		struct node_data *n = get_sorted_neighbor(rank);
+
+		/* "%s @%04x S:%d D:%.2f" */
+		end = fmt_str(str_buf, n->name);
+		end = fmt_str(end, " @");
+		end = fmt_hex16(end, n->address);
+		end = fmt_str(end, " S:");
+		end = fmt_int(end, n->rssi);
+		end = fmt_str(end, " D:");
+		end = fmt_fixed(end, n->filtered_distance, 2, 0);
+		end = fmt_str(end, "\n");
+
+		epd_print_line(FONT_SMALL, line++, str_buf, end - str_buf, false);
 	}
 
 	// Output average temperature
-	len = snprintf(str_buf, sizeof(str_buf), "Avg. temperature: %.2f\n", average_node_temperature);
-	print_line(FONT_SMALL, 6, str_buf, len, false);
+	end = fmt_str(str_buf, "Avg. temperature: ");
+	end = fmt_fixed(end, average_node_temperature, 2, 0);
+	end = fmt_str(end, "\n");
+	epd_print_line(FONT_SMALL, NEIGHBORS_PER_PAGE + 1, str_buf, end - str_buf, false);
 
-	cfb_framebuffer_finalize(display_dev);
-	k_delayed_work_submit(&display_work, interval);
-
-	return;
+	epd_commit();
 }
 
 //** this is my function. LOOK HERE LOOK HERE LOOK HERE **//
@@ -515,24 +773,53 @@ static void my_data(k_timeout_t interval)
 
 static void display_update(struct k_work *work)
 {
+	uint32_t start = k_cycle_get_32();
+	int i;
+
+	display_scheduled = false;
+
+	/* Text shown for a duration is over, bring the screen back */
+	if (text_shown) {
+		text_shown = false;
+		display_forced = true;
+	}
+
+	/* Nothing the screen shows has changed, leave the panel alone */
+	if (!display_forced && !screen_is_stale()) {
+		return;
+	}
+
+	display_forced = false;
+	display_ts = k_uptime_get();
+
+	for (i = 0; i < BOARD_MODEL_COUNT; i++) {
+		drawn_gen[i] = atomic_get(&model_gen[i]);
+	}
+
 	switch (screen_id) 
 	{
 		case MY_SCREEN:
-			my_data(K_SECONDS(1));
-			return;
+			my_data();
+			break;
 
 		case SCREEN_STATS:
 			show_statistics();
-			return;
+			break;
 
 		case SCREEN_SENSORS:
-			show_sensors_data(K_SECONDS(2));
-			return;
+			show_sensors_data();
+			break;
+
+		case SCREEN_ENERGY:
+			show_energy();
+			break;
 
 		case SCREEN_MAIN:
 			show_main();
-			return;
+			break;
 	}
+
+	energy_work(start);
 }
 
 static void long_press(struct k_work *work)
@@ -546,17 +833,78 @@ static void long_press(struct k_work *work)
 
 static void sensor_values_update(struct k_work *work)
 {
+	uint32_t start = k_cycle_get_32();
+	int32_t old_temperature = temperature;
+	int old_humidity = humidity;
+	int old_light = light;
+	int old_proximity = proximity;
+	bool accel_changed = false;
+
 	update_hdc1010_values();
 	update_apds9960_values();
 
-	self_node_data.proximity = proximity;
-	self_node_data.light = light;
-	self_node_data.temperature = temperature;
+	/* The accelerometer is only shown, sample it while it's on screen */
+	if (screen_id == SCREEN_SENSORS) {
+		struct sensor_value val[3];
+
+		if (!get_mma8652_val(val) && memcmp(val, accel, sizeof(val))) {
+			memcpy(accel, val, sizeof(accel));
+			accel_changed = true;
+		}
+	}
+
+	if (accel_changed || temperature != old_temperature ||
+	    humidity != old_humidity || light != old_light ||
+	    proximity != old_proximity) {
+		board_model_changed(BOARD_MODEL_SENSORS);
+	}
+
+	self_proximity = proximity;
+	self_node_data.temperature = (temperature + (temperature < 0 ? -5 : 5)) / 10;
 	self_node_data.humidity = humidity;
 
 	update_average_temperature();
 
-	k_delayed_work_submit(&sensor_values_work, SENSOR_VALUES_REFRESH_INTERVAL);
+	mesh_sensor_update(temperature, humidity * 100);
+
+	energy_work(start);
+
+	if (sensor_interval_ms) {
+		k_delayed_work_submit(&sensor_values_work,
+				      K_MSEC(sensor_interval_ms));
+	}
+}
+
+static const char *const log_level_names[] = {
+	"off", "err", "wrn", "inf", "dbg",
+};
+
+/* The display is only drawn from the work queue, never from the ISR */
+static void show_log_level(struct k_work *work)
+{
+	snprintk(str_buf, sizeof(str_buf), "Log level: %s",
+		 log_level_names[app_log_level_get()]);
+	board_show_text(str_buf, false, K_SECONDS(1));
+}
+
+static void gateway_toggle(struct k_work *work)
+{
+	gateway_set_enabled(!gateway_is_enabled());
+	board_show_text(gateway_is_enabled() ? "Gateway on" : "Gateway off",
+			false, K_SECONDS(1));
+}
+
+/* A single press, once it's clear that no second one follows */
+static void snapshot(struct k_work *work)
+{
+	app_log_snapshot_request();
+}
+
+static void cycle_log_level(void)
+{
+	app_log_level_set((app_log_level_get() + 1) %
+			  ARRAY_SIZE(log_level_names));
+	k_work_submit(&log_level_work);
 }
 
 static bool button_is_pressed(void)
@@ -589,7 +937,32 @@ static void button_interrupt(const struct device *dev,
 	/* Short press for views */
 	switch (screen_id) {
 	case SCREEN_SENSORS:
-	case SCREEN_STATS:
+		cycle_log_level();
+		return;
+	case SCREEN_STATS: {
+		/* A double press makes this board the gateway */
+		uint32_t uptime = k_uptime_get_32();
+		static uint32_t press_ts;
+
+		if (uptime - press_ts < DOUBLE_PRESS_MS) {
+			k_delayed_work_cancel(&snapshot_work);
+			k_work_submit(&gateway_toggle_work);
+		} else {
+			k_delayed_work_submit(&snapshot_work,
+					      K_MSEC(DOUBLE_PRESS_MS));
+		}
+
+		press_ts = uptime;
+		return;
+	}
+	case MY_SCREEN:
+		neighbor_page++;
+		board_refresh_display();
+		return;
+	case SCREEN_ENERGY:
+		/* The other boards answer on the console */
+		mesh_send_energy_get();
+		board_refresh_display();
 		return;
 	case SCREEN_MAIN:
 		if (pins & BIT(DT_GPIO_PIN(DT_ALIAS(sw0), gpios))) {
@@ -710,6 +1083,8 @@ static int erase_storage(void)
 
 void board_refresh_display(void)
 {
+	display_forced = true;
+	display_scheduled = true;
 	k_delayed_work_submit(&display_work, K_NO_WAIT);
 }
 
@@ -718,6 +1093,27 @@ void start_sensor_values_work()
 	k_delayed_work_submit(&sensor_values_work, K_NO_WAIT);
 }
 
+void board_set_sensor_interval(uint32_t interval_ms)
+{
+	bool restart = !sensor_interval_ms ||
+		       (interval_ms < sensor_interval_ms &&
+			k_delayed_work_remaining_get(&sensor_values_work));
+
+	sensor_interval_ms = interval_ms;
+
+	/* A longer interval starts after the pending sample */
+	if (!interval_ms) {
+		k_delayed_work_cancel(&sensor_values_work);
+	} else if (restart) {
+		k_delayed_work_submit(&sensor_values_work, K_NO_WAIT);
+	}
+}
+
+void board_set_display_interval(uint32_t interval_ms)
+{
+	display_interval_ms = interval_ms;
+}
+
 int board_init(void)
 {
 	display_dev = device_get_binding(DT_LABEL(DT_INST(0, solomon_ssd16xxfb)));
@@ -728,14 +1124,12 @@ int board_init(void)
 		return -ENODEV;
 	}
 
-	if (cfb_framebuffer_init(display_dev)) 
+	if (epd_init(display_dev)) 
 	{
 		printk("Framebuffer initialization failed\n");
 		return -EIO;
 	}
 
-	cfb_framebuffer_clear(display_dev, true);
-
 	if (configure_button()) 
 	{
 		printk("Failed to configure button\n");
@@ -751,6 +1145,9 @@ int board_init(void)
 	k_delayed_work_init(&display_work, display_update);
 	k_delayed_work_init(&long_press_work, long_press);
 	k_delayed_work_init(&sensor_values_work, sensor_values_update);
+	k_work_init(&log_level_work, show_log_level);
+	k_work_init(&gateway_toggle_work, gateway_toggle);
+	k_delayed_work_init(&snapshot_work, snapshot);
 
 	pressed = button_is_pressed();
 
@@ -0,0 +1,176 @@
+/*
+ * Density-aware relaying. Every node counts the direct neighbors it heard
+ * heartbeats from recently. With fewer than RELAY_DENSE_NEIGHBORS of them
+ * the node relays. In a denser neighborhood the nodes rank themselves and
+ * their direct neighbors with a fixed hash of the address, and only the
+ * top RELAY_ELECTED keep relaying: every node of the neighborhood computes
+ * about the same ranking, so each one still has a few relays around it
+ * while the rest stop rebroadcasting every heartbeat.
+ *
+ * A decision has to hold for two windows before the relay state changes.
+ * The power level can take the node out of the election, it then stops
+ * relaying right away. Without relay support in the build (the badge) the
+ * controller stays off.
+ */
+
+#include <zephyr.h>
+#include <sys/printk.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/mesh.h>
+
+#include "mesh.h"
+#include "relay_ctl.h"
+
+#define RELAY_WINDOW_MS		(30 * MSEC_PER_SEC)
+#define RELAY_NEIGHBOR_TIMEOUT_MS (3 * RELAY_WINDOW_MS)
+#define RELAY_NEIGHBORS_MAX	CONFIG_APP_SOURCE_COUNT
+
+#define RELAY_DENSE_NEIGHBORS	6
+#define RELAY_ELECTED		3
+
+/* Too weak to count, the neighbor can't rely on us for its coverage */
+#define RELAY_RSSI_MIN		-90
+
+struct relay_neighbor {
+	uint16_t addr;
+	int8_t rssi;
+	uint32_t last_rx;
+};
+
+static struct relay_neighbor neighbors[RELAY_NEIGHBORS_MAX];
+static bool relay = IS_ENABLED(CONFIG_BT_MESH_RELAY);
+static bool allowed = true;
+static bool pending;
+/* The stored relay state may come from an earlier run, set it once anyway */
+static bool applied;
+static uint8_t neighbor_count;
+
+static struct k_delayed_work window_work;
+
+/* Bijective on 16 bits, so no two addresses rank the same */
+static uint16_t rank_key(uint16_t addr)
+{
+	return addr * 0x9e37U;
+}
+
+void relay_ctl_observe(uint16_t addr, uint8_t hops, int8_t rssi)
+{
+	struct relay_neighbor *slot = &neighbors[0];
+	int i;
+
+	if (!IS_ENABLED(CONFIG_BT_MESH_RELAY) || hops != 1U) {
+		return;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(neighbors); i++) {
+		if (neighbors[i].addr == addr) {
+			slot = &neighbors[i];
+			break;
+		}
+
+		if (neighbors[i].last_rx < slot->last_rx) {
+			slot = &neighbors[i];
+		}
+	}
+
+	if (slot->addr != addr) {
+		slot->addr = addr;
+		slot->rssi = rssi;
+	}
+
+	/* Smoothed like the distance, a single weak packet doesn't count */
+	slot->rssi += (rssi - slot->rssi) / 4;
+	slot->last_rx = k_uptime_get_32();
+}
+
+static bool relay_decide(void)
+{
+	uint16_t own = rank_key(mesh_get_addr());
+	uint32_t now = k_uptime_get_32();
+	uint8_t count = 0U, above = 0U;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(neighbors); i++) {
+		struct relay_neighbor *n = &neighbors[i];
+
+		if (n->addr == BT_MESH_ADDR_UNASSIGNED ||
+		    now - n->last_rx > RELAY_NEIGHBOR_TIMEOUT_MS ||
+		    n->rssi < RELAY_RSSI_MIN) {
+			continue;
+		}
+
+		count++;
+
+		if (rank_key(n->addr) > own) {
+			above++;
+		}
+	}
+
+	neighbor_count = count;
+
+	return count < RELAY_DENSE_NEIGHBORS || above < RELAY_ELECTED;
+}
+
+static void window_end(struct k_work *work)
+{
+	bool decision = relay_decide() && allowed;
+
+	if (decision == relay && applied) {
+		pending = false;
+	} else if (!pending && applied) {
+		pending = true;
+	} else if (!mesh_relay_set(decision)) {
+		pending = false;
+		applied = true;
+		relay = decision;
+		printk("Relay %s (%u direct neighbors)\n",
+		       relay ? "on" : "off", neighbor_count);
+	}
+
+	k_delayed_work_submit(&window_work, K_MSEC(RELAY_WINDOW_MS));
+}
+
+void relay_ctl_allow(bool allow)
+{
+	allowed = allow;
+
+	if (!IS_ENABLED(CONFIG_BT_MESH_RELAY)) {
+		return;
+	}
+
+	if (!allow && relay && !mesh_relay_set(false)) {
+		pending = false;
+		applied = true;
+		relay = false;
+		printk("Relay off (power level)\n");
+	}
+}
+
+bool relay_ctl_is_relay(void)
+{
+	return relay;
+}
+
+void relay_ctl_print(void)
+{
+	if (!IS_ENABLED(CONFIG_BT_MESH_RELAY)) {
+		printk("Relay not built in\n");
+		return;
+	}
+
+	printk("Relay %s, %u direct neighbors\n", relay ? "on" : "off",
+	       neighbor_count);
+}
+
+int relay_ctl_init(void)
+{
+	if (!IS_ENABLED(CONFIG_BT_MESH_RELAY)) {
+		return 0;
+	}
+
+	k_delayed_work_init(&window_work, window_end);
+	k_delayed_work_submit(&window_work, K_MSEC(RELAY_WINDOW_MS));
+
+	return 0;
+}
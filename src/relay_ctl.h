@@ -0,0 +1,10 @@
+/*
+ * Density-aware relaying: in a crowded neighborhood only a few elected
+ * nodes keep the relay feature on, elsewhere every node relays.
+ */
+
+void relay_ctl_observe(uint16_t addr, uint8_t hops, int8_t rssi);
+void relay_ctl_allow(bool allow);
+bool relay_ctl_is_relay(void);
+void relay_ctl_print(void);
+int relay_ctl_init(void);
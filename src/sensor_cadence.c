@@ -0,0 +1,232 @@
+/*
+ * Sensor Cadence and Sensor Setting states of the Sensor Server
+ * (Mesh Model Specification 4.1.3 and 4.1.4).
+ */
+
+#include <zephyr.h>
+#include <stdlib.h>
+
+#include <bluetooth/mesh.h>
+
+#include "sensor_cadence.h"
+
+/* Highest values allowed by the spec for the divisor and the interval */
+#define FAST_PERIOD_DIV_MAX	15
+#define MIN_INTERVAL_MAX	26
+
+/*
+ * Temperature is a sint16 in 0.01 degrees Celsius and humidity a uint16 in
+ * 0.01 percent. Both publish four times faster while outside the comfortable
+ * range, and immediately on a 0.5 C / 5 % swing, at most every ~4 seconds.
+ */
+struct sensor_prop sensor_props[SENS_PROP_COUNT] = {
+	{
+		.id = SENS_PROP_ID_PRESENT_DEVICE_TEMP,
+		.size = 2,
+		.cadence = {
+			.fast_period_div = 2,
+			.trigger_type = SENS_TRIGGER_TYPE_VALUE,
+			.delta_down = 50,
+			.delta_up = 50,
+			.min_interval = 12,
+			.fast_low = 3000,
+			.fast_high = 1500,
+		},
+		.setting = {
+			.prop_id = SENS_SETTING_PROP_ID_TEMP_OFFSET,
+			.access = SENS_SETTING_ACCESS_READ_WRITE,
+		},
+	},
+	{
+		.id = SENS_PROP_ID_PRESENT_AMB_REL_HUMIDITY,
+		.size = 2,
+		.cadence = {
+			.fast_period_div = 2,
+			.trigger_type = SENS_TRIGGER_TYPE_VALUE,
+			.delta_down = 500,
+			.delta_up = 500,
+			.min_interval = 12,
+			.fast_low = 7000,
+			.fast_high = 2000,
+		},
+		.setting = {
+			.prop_id = SENS_SETTING_PROP_ID_HUMIDITY_OFFSET,
+			.access = SENS_SETTING_ACCESS_READ_WRITE,
+		},
+	},
+};
+
+struct sensor_prop *sensor_prop_find(uint16_t id)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sensor_props); i++) {
+		if (sensor_props[i].id == id) {
+			return &sensor_props[i];
+		}
+	}
+
+	return NULL;
+}
+
+void sensor_props_sample(int32_t temperature, int32_t humidity)
+{
+	struct sensor_prop *prop;
+
+	prop = sensor_prop_find(SENS_PROP_ID_PRESENT_DEVICE_TEMP);
+	prop->value = temperature + prop->setting.value;
+
+	prop = sensor_prop_find(SENS_PROP_ID_PRESENT_AMB_REL_HUMIDITY);
+	prop->value = CLAMP(humidity + prop->setting.value, 0, 10000);
+}
+
+bool sensor_prop_delta_triggered(const struct sensor_prop *prop)
+{
+	const struct sensor_cadence *cadence = &prop->cadence;
+	int32_t delta = prop->value - prop->last_pub_value;
+	int64_t down = cadence->delta_down;
+	int64_t up = cadence->delta_up;
+
+	if (delta == 0) {
+		return false;
+	}
+
+	if (cadence->trigger_type == SENS_TRIGGER_TYPE_PERCENT) {
+		/* Deltas are in 0.01 % of the last published value */
+		int64_t base = abs(prop->last_pub_value);
+
+		down = base * down / 10000;
+		up = base * up / 10000;
+	}
+
+	if (delta > 0) {
+		return delta >= up;
+	}
+
+	return -delta >= down;
+}
+
+bool sensor_prop_fast_cadence(const struct sensor_prop *prop)
+{
+	const struct sensor_cadence *cadence = &prop->cadence;
+
+	if (cadence->fast_high >= cadence->fast_low) {
+		return prop->value >= cadence->fast_low &&
+		       prop->value <= cadence->fast_high;
+	}
+
+	return prop->value < cadence->fast_high ||
+	       prop->value > cadence->fast_low;
+}
+
+bool sensor_prop_min_interval_elapsed(const struct sensor_prop *prop,
+				      int64_t now)
+{
+	if (!prop->last_pub_ts) {
+		return true;
+	}
+
+	return now - prop->last_pub_ts >=
+	       ((int64_t)1 << prop->cadence.min_interval);
+}
+
+void sensor_prop_published(struct sensor_prop *prop, int64_t now)
+{
+	prop->last_pub_value = prop->value;
+	prop->last_pub_ts = now;
+}
+
+uint8_t sensor_fast_period_div(int32_t period_ms)
+{
+	uint8_t div = 0U;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sensor_props); i++) {
+		const struct sensor_prop *prop = &sensor_props[i];
+		uint8_t prop_div = prop->cadence.fast_period_div;
+
+		if (!sensor_prop_fast_cadence(prop)) {
+			continue;
+		}
+
+		/* Never publish faster than the Status Min Interval allows */
+		while (prop_div && (period_ms >> prop_div) <
+		       ((int64_t)1 << prop->cadence.min_interval)) {
+			prop_div--;
+		}
+
+		div = MAX(div, prop_div);
+	}
+
+	return div;
+}
+
+static int32_t pull_value(const struct sensor_prop *prop,
+			  struct net_buf_simple *buf)
+{
+	uint16_t raw = net_buf_simple_pull_le16(buf);
+
+	if (prop->id == SENS_PROP_ID_PRESENT_DEVICE_TEMP) {
+		return (int16_t)raw;
+	}
+
+	return raw;
+}
+
+int sensor_cadence_pull(struct sensor_prop *prop, struct net_buf_simple *buf)
+{
+	struct sensor_cadence cadence;
+	size_t delta_size;
+	uint8_t div_type;
+
+	if (buf->len < 1) {
+		return -EINVAL;
+	}
+
+	div_type = net_buf_simple_pull_u8(buf);
+	cadence.fast_period_div = div_type & 0x7f;
+	cadence.trigger_type = div_type >> 7;
+
+	delta_size = cadence.trigger_type == SENS_TRIGGER_TYPE_PERCENT ?
+		     2 : prop->size;
+
+	if (buf->len != 2 * delta_size + 1 + 2 * prop->size) {
+		return -EINVAL;
+	}
+
+	if (cadence.trigger_type == SENS_TRIGGER_TYPE_PERCENT) {
+		cadence.delta_down = net_buf_simple_pull_le16(buf);
+		cadence.delta_up = net_buf_simple_pull_le16(buf);
+	} else {
+		cadence.delta_down = abs(pull_value(prop, buf));
+		cadence.delta_up = abs(pull_value(prop, buf));
+	}
+
+	cadence.min_interval = net_buf_simple_pull_u8(buf);
+	cadence.fast_low = pull_value(prop, buf);
+	cadence.fast_high = pull_value(prop, buf);
+
+	if (cadence.fast_period_div > FAST_PERIOD_DIV_MAX ||
+	    cadence.min_interval > MIN_INTERVAL_MAX) {
+		return -EINVAL;
+	}
+
+	prop->cadence = cadence;
+
+	return 0;
+}
+
+void sensor_cadence_add(const struct sensor_prop *prop,
+			struct net_buf_simple *msg)
+{
+	const struct sensor_cadence *cadence = &prop->cadence;
+
+	net_buf_simple_add_le16(msg, prop->id);
+	net_buf_simple_add_u8(msg, cadence->fast_period_div |
+			      (cadence->trigger_type << 7));
+	net_buf_simple_add_le16(msg, cadence->delta_down);
+	net_buf_simple_add_le16(msg, cadence->delta_up);
+	net_buf_simple_add_u8(msg, cadence->min_interval);
+	net_buf_simple_add_le16(msg, cadence->fast_low);
+	net_buf_simple_add_le16(msg, cadence->fast_high);
+}
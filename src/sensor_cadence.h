@@ -0,0 +1,64 @@
+/*
+ * Sensor Cadence and Sensor Setting states of the Sensor Server
+ * (Mesh Model Specification 4.1.3 and 4.1.4).
+ */
+
+#define SENS_PROP_ID_PRESENT_DEVICE_TEMP	0x0054
+#define SENS_PROP_ID_PRESENT_AMB_REL_HUMIDITY	0x0076
+
+/* App-defined Sensor Settings: additive offsets applied to the readings */
+#define SENS_SETTING_PROP_ID_TEMP_OFFSET	0x0105
+#define SENS_SETTING_PROP_ID_HUMIDITY_OFFSET	0x0106
+
+#define SENS_SETTING_ACCESS_READ		0x01
+#define SENS_SETTING_ACCESS_READ_WRITE		0x03
+
+#define SENS_TRIGGER_TYPE_VALUE		0
+#define SENS_TRIGGER_TYPE_PERCENT	1
+
+#define SENS_PROP_COUNT 2
+
+struct sensor_cadence {
+	uint8_t fast_period_div;
+	uint8_t trigger_type;
+	int32_t delta_down;
+	int32_t delta_up;
+	/* Minimum interval between two Sensor Status messages, 2^n ms */
+	uint8_t min_interval;
+	int32_t fast_low;
+	int32_t fast_high;
+};
+
+struct sensor_setting {
+	uint16_t prop_id;
+	uint8_t access;
+	int16_t value;
+};
+
+struct sensor_prop {
+	uint16_t id;
+	/* Raw value length in the Sensor Status marshalling, in octets */
+	uint8_t size;
+	struct sensor_cadence cadence;
+	struct sensor_setting setting;
+
+	int32_t value;
+	int32_t last_pub_value;
+	int64_t last_pub_ts;
+};
+
+extern struct sensor_prop sensor_props[SENS_PROP_COUNT];
+
+struct sensor_prop *sensor_prop_find(uint16_t id);
+
+void sensor_props_sample(int32_t temperature, int32_t humidity);
+bool sensor_prop_delta_triggered(const struct sensor_prop *prop);
+bool sensor_prop_fast_cadence(const struct sensor_prop *prop);
+bool sensor_prop_min_interval_elapsed(const struct sensor_prop *prop,
+				      int64_t now);
+void sensor_prop_published(struct sensor_prop *prop, int64_t now);
+uint8_t sensor_fast_period_div(int32_t period_ms);
+
+int sensor_cadence_pull(struct sensor_prop *prop, struct net_buf_simple *buf);
+void sensor_cadence_add(const struct sensor_prop *prop,
+			struct net_buf_simple *msg);
@@ -0,0 +1,99 @@
+/*
+ * Per-source window over the application sequence numbers of the vendor
+ * heartbeats. The newest sequence number is kept with a bitmap of the ones
+ * received just before it. A sequence number far behind the window, or a
+ * run of stale ones, means the source restarted and starts a new window.
+ */
+
+#include <zephyr.h>
+
+#include "seq_window.h"
+
+#define SEQ_WINDOW_SIZE		32
+#define SEQ_SOURCES_MAX		CONFIG_APP_SOURCE_COUNT
+
+/* Stale updates in a row taken as a restart of the source */
+#define SEQ_STALE_RESTART	3
+
+struct seq_source {
+	uint16_t addr;
+	uint16_t top;
+	uint32_t seen;
+	uint8_t stale_run;
+	uint32_t last_rx;
+};
+
+static struct seq_source sources[SEQ_SOURCES_MAX];
+
+static struct seq_source *source_get(uint16_t addr, bool *created)
+{
+	struct seq_source *slot = &sources[0];
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sources); i++) {
+		if (sources[i].addr == addr) {
+			*created = false;
+			return &sources[i];
+		}
+
+		/* Otherwise replace the one silent for the longest */
+		if (sources[i].last_rx < slot->last_rx) {
+			slot = &sources[i];
+		}
+	}
+
+	slot->addr = addr;
+	*created = true;
+
+	return slot;
+}
+
+static void window_restart(struct seq_source *src, uint16_t seq)
+{
+	src->top = seq;
+	src->seen = BIT(0);
+	src->stale_run = 0U;
+}
+
+enum seq_check seq_window_check(uint16_t addr, uint16_t seq)
+{
+	struct seq_source *src;
+	int16_t delta;
+	bool created;
+
+	src = source_get(addr, &created);
+	src->last_rx = k_uptime_get_32();
+
+	if (created) {
+		window_restart(src, seq);
+		return SEQ_NEW;
+	}
+
+	delta = seq - src->top;
+
+	if (delta > 0) {
+		src->seen = delta < SEQ_WINDOW_SIZE ?
+			    (src->seen << delta) | BIT(0) : BIT(0);
+		src->top = seq;
+		src->stale_run = 0U;
+		return SEQ_NEW;
+	}
+
+	if (-delta >= SEQ_WINDOW_SIZE) {
+		window_restart(src, seq);
+		return SEQ_NEW;
+	}
+
+	if (src->seen & BIT(-delta)) {
+		return SEQ_DUPLICATE;
+	}
+
+	if (++src->stale_run >= SEQ_STALE_RESTART) {
+		window_restart(src, seq);
+		return SEQ_NEW;
+	}
+
+	src->seen |= BIT(-delta);
+
+	return SEQ_STALE;
+}
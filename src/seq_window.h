@@ -0,0 +1,14 @@
+/*
+ * Per-source window over the application sequence numbers of the vendor
+ * heartbeats, so echoes and late copies are dropped before parsing.
+ */
+
+enum seq_check {
+	SEQ_NEW,
+	/* Already received through another relay */
+	SEQ_DUPLICATE,
+	/* Older than an update already applied */
+	SEQ_STALE,
+};
+
+enum seq_check seq_window_check(uint16_t addr, uint16_t seq);
@@ -0,0 +1,137 @@
+/*
+ * Testbed mode, for runs on a set of boards flashed with the same build. The
+ * sensors are replaced by a script derived from the identity address, so
+ * every node reads a plausible value of its own without the I2C parts: a
+ * temperature drifting up and down by a degree over ten minutes, a fixed
+ * humidity and the board lying flat in the dark. The badge is scripted to
+ * move once a minute, which keeps it at the active power level and the
+ * heartbeat period fixed for the whole run.
+ *
+ * Once a minute every node prints a CSV line with its counters:
+ *
+ *   sim,addr,uptime_s,hb_received,hb_expected,tx_pdus,tx_bytes,airtime_ms,
+ *   work_ms,relayed,latency_p50_ms,latency_p90_ms
+ *
+ * The latency is the end-to-end heartbeat latency over every source, it
+ * needs MESH_TRACE and is 0 without it. It is the upper bound of a
+ * histogram bin, 65535 for the last one, which holds everything from 1024 ms,
+ * see trace.h.
+ *
+ * The per-source tables (sequence windows, relay election, latency by
+ * source) hold CONFIG_APP_SOURCE_COUNT nodes, a run with more nodes in range
+ * of each other evicts entries and its numbers no longer hold.
+ */
+
+#include <zephyr.h>
+#include <string.h>
+#include <sys/printk.h>
+#include <sys/crc.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/mesh.h>
+#include <drivers/sensor.h>
+
+#include "mesh.h"
+#include "board.h"
+#include "power.h"
+#include "energy.h"
+#include "trace.h"
+#include "sim.h"
+
+#define SIM_REPORT_INTERVAL	K_MINUTES(1)
+#define SIM_MOTION_INTERVAL	K_MINUTES(1)
+
+/* Temperature swing in 0.01 C, and the time it takes there and back */
+#define SIM_TEMP_SWING		100
+#define SIM_TEMP_PERIOD_MS	(10 * 60 * MSEC_PER_SEC)
+
+/*
+ * Air time of a network PDU: the advertising PDU around the mesh network
+ * header, NetMIC and transport header, at 8 us per octet on 1M PHY, on three
+ * advertising channels and sent three times.
+ */
+#define PDU_OVERHEAD_BYTES	(16 + 2 + 9 + 4 + 1)
+#define AIRTIME_US_PER_BYTE	(8 * 3 * 3)
+
+static uint16_t seed;
+
+static struct k_delayed_work report_work;
+static struct k_delayed_work motion_work;
+
+void sim_hdc1010_val(struct sensor_value *val)
+{
+	uint32_t phase = (k_uptime_get_32() + seed * 997U) % SIM_TEMP_PERIOD_MS;
+	int32_t temp;
+
+	/* Triangle wave, up for half the period and down for the other */
+	temp = 2000 + (seed % 8) * 25 +
+	       SIM_TEMP_SWING * (int32_t)MIN(phase, SIM_TEMP_PERIOD_MS - phase) /
+	       (SIM_TEMP_PERIOD_MS / 2);
+
+	val[0].val1 = temp / 100;
+	val[0].val2 = (temp % 100) * 10000;
+	val[1].val1 = 35 + seed % 20;
+	val[1].val2 = 0;
+}
+
+void sim_mma8652_val(struct sensor_value *val)
+{
+	memset(val, 0, 3 * sizeof(*val));
+	sensor_g_to_ms2(1, &val[2]);
+}
+
+void sim_apds9960_val(struct sensor_value *val)
+{
+	/* Nothing close enough to start a calibration */
+	memset(val, 0, 2 * sizeof(*val));
+}
+
+static void report(struct k_work *work)
+{
+	static struct energy_report r;
+	uint32_t received, expected, pdus, bytes, airtime_ms;
+
+	energy_report(&r);
+	board_link_totals(&received, &expected);
+
+	pdus = r.events[ENERGY_TX_UNSEG].count + r.events[ENERGY_TX_SEG].count;
+	bytes = r.events[ENERGY_TX_UNSEG].bytes + r.events[ENERGY_TX_SEG].bytes;
+	airtime_ms = ((uint64_t)pdus * PDU_OVERHEAD_BYTES + bytes) *
+		     AIRTIME_US_PER_BYTE / USEC_PER_MSEC;
+
+	printk("sim,%04x,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u\n", mesh_get_addr(),
+	       r.uptime_ms / MSEC_PER_SEC, received, expected, pdus, bytes,
+	       airtime_ms, r.work_ms, r.events[ENERGY_RELAY].count,
+	       trace_end_to_end(50), trace_end_to_end(90));
+
+	k_delayed_work_submit(&report_work, SIM_REPORT_INTERVAL);
+}
+
+static void motion(struct k_work *work)
+{
+	power_motion();
+
+	k_delayed_work_submit(&motion_work, SIM_MOTION_INTERVAL);
+}
+
+int sim_init(void)
+{
+	bt_addr_le_t addrs[CONFIG_BT_ID_MAX];
+	size_t count = ARRAY_SIZE(addrs);
+
+	/* Stable across restarts, unlike the mesh address */
+	bt_id_get(addrs, &count);
+	seed = crc16_ccitt(0, addrs[BT_ID_DEFAULT].a.val,
+			   sizeof(addrs[BT_ID_DEFAULT].a.val));
+
+	printk("sim,addr,uptime_s,hb_received,hb_expected,tx_pdus,tx_bytes,"
+	       "airtime_ms,work_ms,relayed,latency_p50_ms,latency_p90_ms\n");
+
+	k_delayed_work_init(&report_work, report);
+	k_delayed_work_submit(&report_work, SIM_REPORT_INTERVAL);
+
+	k_delayed_work_init(&motion_work, motion);
+	k_delayed_work_submit(&motion_work, SIM_MOTION_INTERVAL);
+
+	return 0;
+}
@@ -0,0 +1,9 @@
+/*
+ * Simulation mode, built in with MESH_SIM: scripted stand-ins for the sensors
+ * and a periodic per-node report on the console for tools/sim_report.py.
+ */
+
+void sim_hdc1010_val(struct sensor_value *val);
+void sim_mma8652_val(struct sensor_value *val);
+void sim_apds9960_val(struct sensor_value *val);
+int sim_init(void);
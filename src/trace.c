@@ -0,0 +1,320 @@
+/*
+ * Heartbeat latency tracing.
+ *
+ * The time base follows the lowest address in the network. Every node sends
+ * a one hop time beacon per period with the master address, its distance to
+ * the master in beacons (stratum) and its own mesh time. A node takes the
+ * time of a beacon for a lower master, or of a neighbor closer to its master,
+ * plus the typical one hop delay. One hop beacons don't go through the relay
+ * queues, so the error they add stays far below the latency of the
+ * heartbeats relayed across the network. A node that hears no beacon for a
+ * few periods becomes a master itself, from the time it already has.
+ *
+ * Heartbeats carry the low 16 bits of the mesh time, which covers a minute.
+ */
+
+#include <zephyr.h>
+#include <string.h>
+#include <sys/printk.h>
+#include <random/rand32.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/mesh.h>
+
+#include "mesh.h"
+#include "gateway.h"
+#include "trace.h"
+
+#define TRACE_PERIOD_MS		(10 * MSEC_PER_SEC)
+#define TRACE_JITTER_MS		500
+#define TRACE_TIMEOUT_PERIODS	3
+#define TRACE_STRATUM_MAX	16
+
+/* Above every unicast address, so the first beacon heard always wins */
+#define TRACE_MASTER_NONE	0xffff
+
+/* Advertising delay of a single hop, random between 0 and 10 ms */
+#define TRACE_HOP_DELAY_MS	5
+
+/* Upper bounds of the bins, the last one holds everything from 1 s */
+static const uint16_t bin_bounds[TRACE_BINS] = {
+	16, 32, 64, 128, 256, 512, 1024, TRACE_LATENCY_OPEN,
+};
+
+static struct {
+	uint16_t master;
+	uint8_t stratum;
+	int32_t offset;
+	uint32_t last_sync;
+} time_base = {
+	.master = TRACE_MASTER_NONE,
+};
+
+static struct trace_hist hops[TRACE_HOPS];
+
+static struct {
+	uint16_t addr;
+	uint32_t last_rx;
+	struct trace_hist hist;
+} sources[TRACE_SOURCES];
+
+/* Stamps ahead of the local time base, the clocks disagree */
+static uint32_t skewed;
+
+static struct trace_report report;
+static struct k_delayed_work period_work;
+
+uint32_t trace_time(void)
+{
+	return k_uptime_get_32() + time_base.offset;
+}
+
+static bool is_master(void)
+{
+	return time_base.master == mesh_get_addr();
+}
+
+void trace_beacon_recv(uint16_t master, uint8_t stratum, uint32_t time)
+{
+	if (!MESH_TRACE || stratum >= TRACE_STRATUM_MAX) {
+		return;
+	}
+
+	if (master > time_base.master ||
+	    (master == time_base.master && !is_master() &&
+	     stratum >= time_base.stratum)) {
+		return;
+	}
+
+	if (master == time_base.master && is_master()) {
+		/* Our own time, coming back from a neighbor */
+		return;
+	}
+
+	if (master != time_base.master) {
+		printk("Time base from 0x%04x\n", master);
+	}
+
+	time_base.master = master;
+	time_base.stratum = stratum + 1;
+	time_base.offset = time + TRACE_HOP_DELAY_MS - k_uptime_get_32();
+	time_base.last_sync = k_uptime_get_32();
+}
+
+static void hist_add(struct trace_hist *h, uint16_t latency)
+{
+	int bin, i;
+
+	for (bin = 0; bin < TRACE_BINS - 1 && latency >= bin_bounds[bin];
+	     bin++) {
+	}
+
+	if (h->bins[bin] == UINT8_MAX) {
+		for (i = 0; i < TRACE_BINS; i++) {
+			h->bins[i] /= 2U;
+		}
+	}
+
+	h->bins[bin]++;
+}
+
+static uint16_t percentile(const uint32_t bins[TRACE_BINS], uint8_t percent)
+{
+	uint32_t total = 0U, target, sum = 0U;
+	int i;
+
+	for (i = 0; i < TRACE_BINS; i++) {
+		total += bins[i];
+	}
+
+	if (!total) {
+		return 0;
+	}
+
+	target = ceiling_fraction(total * percent, 100U);
+
+	for (i = 0; i < TRACE_BINS - 1; i++) {
+		sum += bins[i];
+		if (sum >= target) {
+			break;
+		}
+	}
+
+	return bin_bounds[i];
+}
+
+uint16_t trace_percentile(const struct trace_hist *h, uint8_t percent)
+{
+	uint32_t bins[TRACE_BINS];
+	int i;
+
+	for (i = 0; i < TRACE_BINS; i++) {
+		bins[i] = h->bins[i];
+	}
+
+	return percentile(bins, percent);
+}
+
+uint16_t trace_end_to_end(uint8_t percent)
+{
+	uint32_t bins[TRACE_BINS] = { 0 };
+	int hop, i;
+
+	for (hop = 0; hop < TRACE_HOPS; hop++) {
+		for (i = 0; i < TRACE_BINS; i++) {
+			bins[i] += hops[hop].bins[i];
+		}
+	}
+
+	return percentile(bins, percent);
+}
+
+void trace_latency_str(uint16_t ms, char *buf, size_t size)
+{
+	if (ms == TRACE_LATENCY_OPEN) {
+		snprintk(buf, size, "1s+");
+	} else {
+		snprintk(buf, size, "%u", ms);
+	}
+}
+
+const struct trace_hist *trace_hop_hist(uint8_t hop_count)
+{
+	return &hops[CLAMP(hop_count, 1, TRACE_HOPS) - 1];
+}
+
+static struct trace_hist *source_hist(uint16_t addr)
+{
+	int i, slot = 0;
+
+	for (i = 0; i < ARRAY_SIZE(sources); i++) {
+		if (sources[i].addr == addr) {
+			slot = i;
+			break;
+		}
+
+		/* Otherwise replace the stalest one */
+		if (sources[i].last_rx < sources[slot].last_rx) {
+			slot = i;
+		}
+	}
+
+	if (sources[slot].addr != addr) {
+		sources[slot].addr = addr;
+		memset(&sources[slot].hist, 0, sizeof(sources[slot].hist));
+	}
+
+	sources[slot].last_rx = k_uptime_get_32();
+
+	return &sources[slot].hist;
+}
+
+void trace_heartbeat(uint16_t addr, uint8_t hop_count, uint16_t stamp)
+{
+	int16_t latency = (uint16_t)trace_time() - stamp;
+
+	if (latency < 0) {
+		skewed++;
+		latency = 0;
+	}
+
+	hist_add(&hops[CLAMP(hop_count, 1, TRACE_HOPS) - 1], latency);
+	hist_add(source_hist(addr), latency);
+}
+
+static void report_build(void)
+{
+	int i;
+
+	memcpy(report.hops, hops, sizeof(report.hops));
+	report.source_count = 0U;
+
+	for (i = 0; i < ARRAY_SIZE(sources); i++) {
+		struct trace_source *s = &report.sources[report.source_count];
+
+		if (sources[i].addr == BT_MESH_ADDR_UNASSIGNED) {
+			continue;
+		}
+
+		s->addr = sources[i].addr;
+		s->p50 = trace_percentile(&sources[i].hist, 50);
+		s->p90 = trace_percentile(&sources[i].hist, 90);
+		report.source_count++;
+	}
+}
+
+static void period(struct k_work *work)
+{
+	uint32_t now = k_uptime_get_32();
+
+	k_delayed_work_submit(&period_work,
+			      K_MSEC(TRACE_PERIOD_MS - TRACE_JITTER_MS / 2 +
+				     sys_rand32_get() % TRACE_JITTER_MS));
+
+	if (!mesh_is_configured()) {
+		return;
+	}
+
+	/* Nobody with a lower address around, keep going from our time */
+	if (!is_master() &&
+	    (time_base.master > mesh_get_addr() ||
+	     now - time_base.last_sync >
+	     TRACE_TIMEOUT_PERIODS * TRACE_PERIOD_MS)) {
+		printk("Time base master\n");
+		time_base.master = mesh_get_addr();
+		time_base.stratum = 0U;
+	}
+
+	mesh_send_time_beacon(time_base.master, time_base.stratum,
+			      trace_time());
+
+	report_build();
+	gateway_latency_update(&report);
+}
+
+void trace_print(void)
+{
+	char p50[6], p90[6];
+	int i;
+
+	if (!MESH_TRACE) {
+		return;
+	}
+
+	printk("Time base 0x%04x stratum %u, %u skewed stamps\n",
+	       time_base.master, time_base.stratum, skewed);
+
+	printk("Latency by hops (p50/p90 ms):");
+	for (i = 0; i < TRACE_HOPS; i++) {
+		trace_latency_str(trace_percentile(&hops[i], 50), p50,
+				  sizeof(p50));
+		trace_latency_str(trace_percentile(&hops[i], 90), p90,
+				  sizeof(p90));
+		printk(" %s/%s", p50, p90);
+	}
+	printk("\n");
+
+	for (i = 0; i < ARRAY_SIZE(sources); i++) {
+		if (sources[i].addr == BT_MESH_ADDR_UNASSIGNED) {
+			continue;
+		}
+
+		trace_latency_str(trace_percentile(&sources[i].hist, 50), p50,
+				  sizeof(p50));
+		trace_latency_str(trace_percentile(&sources[i].hist, 90), p90,
+				  sizeof(p90));
+		printk("  0x%04x p50 %s ms p90 %s ms\n", sources[i].addr,
+		       p50, p90);
+	}
+}
+
+int trace_init(void)
+{
+	k_delayed_work_init(&period_work, period);
+
+	if (MESH_TRACE) {
+		k_delayed_work_submit(&period_work, K_MSEC(TRACE_PERIOD_MS));
+	}
+
+	return 0;
+}
@@ -0,0 +1,49 @@
+/*
+ * Heartbeat latency tracing, built in with MESH_TRACE. The nodes agree on a
+ * mesh-wide time base, heartbeats carry the time they were sent, and the
+ * receivers keep latency histograms per source and per hop count.
+ */
+
+#define TRACE_HOPS		5
+#define TRACE_SOURCES		CONFIG_APP_SOURCE_COUNT
+/* Below 16 ms, then doubling up to 1 s and more */
+#define TRACE_BINS		8
+/* Percentile in the last bin, which has no upper bound: 1024 ms or more */
+#define TRACE_LATENCY_OPEN	UINT16_MAX
+
+struct trace_hist {
+	/* Saturating, halved when a bin is full */
+	uint8_t bins[TRACE_BINS];
+};
+
+struct trace_source {
+	uint16_t addr;
+	uint16_t p50;
+	uint16_t p90;
+};
+
+struct trace_report {
+	struct trace_hist hops[TRACE_HOPS];
+	uint8_t source_count;
+	struct trace_source sources[TRACE_SOURCES];
+};
+
+/* Mesh-wide time in ms, stamped into heartbeats modulo 2^16 */
+uint32_t trace_time(void);
+void trace_beacon_recv(uint16_t master, uint8_t stratum, uint32_t time);
+void trace_heartbeat(uint16_t addr, uint8_t hops, uint16_t stamp);
+
+/*
+ * Upper bound of the bin holding the percentile, in ms, 0 without data and
+ * TRACE_LATENCY_OPEN in the last bin
+ */
+uint16_t trace_percentile(const struct trace_hist *h, uint8_t percent);
+const struct trace_hist *trace_hop_hist(uint8_t hops);
+/* The same over the heartbeats of every source and hop count */
+uint16_t trace_end_to_end(uint8_t percent);
+
+/* A percentile as text, "1s+" for TRACE_LATENCY_OPEN */
+void trace_latency_str(uint16_t ms, char *buf, size_t size);
+
+void trace_print(void);
+int trace_init(void);
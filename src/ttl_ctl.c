@@ -0,0 +1,95 @@
+/*
+ * Adaptive TTL: tracks the largest hop count heard over the last few
+ * minutes and keeps the send and publish TTLs just above it.
+ *
+ * A message reaches h hops with a TTL of h, the margin covers routes that
+ * get longer before the next window notices.
+ */
+
+#include <zephyr.h>
+#include <sys/printk.h>
+#include <random/rand32.h>
+
+#include "mesh.h"
+#include "ttl_ctl.h"
+
+#define TTL_WINDOW_MS		(60 * MSEC_PER_SEC)
+#define TTL_WINDOWS		5
+#define TTL_MARGIN		2
+#define TTL_MIN			(1 + TTL_MARGIN)
+
+/* Every this many windows one goes out with the full TTL */
+#define TTL_PROBE_WINDOWS	10
+
+static uint8_t window_hops[TTL_WINDOWS];
+static uint8_t window;
+static uint8_t windows_to_probe;
+static uint8_t ttl = MESH_TTL_MAX;
+static uint8_t fixed;
+
+static struct k_delayed_work window_work;
+
+void ttl_ctl_observe(uint8_t hops)
+{
+	window_hops[window] = MAX(window_hops[window], hops);
+
+	/* Farther than we reach, don't wait for the window to end */
+	if (!fixed && hops + TTL_MARGIN > ttl && ttl < MESH_TTL_MAX) {
+		ttl = MIN(hops + TTL_MARGIN, MESH_TTL_MAX);
+		mesh_ttl_update(ttl);
+		printk("TTL raised to %u\n", ttl);
+	}
+}
+
+uint8_t ttl_ctl_get(void)
+{
+	return ttl;
+}
+
+void ttl_ctl_fix(uint8_t fixed_ttl)
+{
+	fixed = fixed_ttl;
+
+	/* Back to the controller from the full TTL, it comes down on its own */
+	ttl = fixed ? fixed : MESH_TTL_MAX;
+	mesh_ttl_update(ttl);
+}
+
+static void window_end(struct k_work *work)
+{
+	uint8_t diameter = 0U, new_ttl;
+	int i;
+
+	for (i = 0; i < TTL_WINDOWS; i++) {
+		diameter = MAX(diameter, window_hops[i]);
+	}
+
+	window = (window + 1) % TTL_WINDOWS;
+	window_hops[window] = 0U;
+
+	if (!windows_to_probe--) {
+		windows_to_probe = TTL_PROBE_WINDOWS - 1;
+		new_ttl = MESH_TTL_MAX;
+	} else {
+		new_ttl = CLAMP(diameter + TTL_MARGIN, TTL_MIN, MESH_TTL_MAX);
+	}
+
+	if (!fixed && new_ttl != ttl) {
+		printk("TTL %u (diameter %u hops)\n", new_ttl, diameter);
+		ttl = new_ttl;
+		mesh_ttl_update(ttl);
+	}
+
+	k_delayed_work_submit(&window_work, K_MSEC(TTL_WINDOW_MS));
+}
+
+int ttl_ctl_init(void)
+{
+	/* Spread the probes of the boards started together */
+	windows_to_probe = sys_rand32_get() % TTL_PROBE_WINDOWS;
+
+	k_delayed_work_init(&window_work, window_end);
+	k_delayed_work_submit(&window_work, K_MSEC(TTL_WINDOW_MS));
+
+	return 0;
+}
@@ -0,0 +1,13 @@
+/*
+ * Adaptive TTL: tracks the largest hop count heard over the last few
+ * minutes and keeps the send and publish TTLs just above it. Now and then a
+ * window goes out with the full TTL, so that nodes beyond the current
+ * horizon hear us and raise theirs. A fixed TTL set at runtime takes over
+ * until it is cleared again.
+ */
+
+void ttl_ctl_observe(uint8_t hops);
+uint8_t ttl_ctl_get(void);
+/* 0 hands the TTL back to the controller */
+void ttl_ctl_fix(uint8_t fixed_ttl);
+int ttl_ctl_init(void);
@@ -0,0 +1,295 @@
+/*
+ * Runtime tuning and introspection. Every parameter has a name, a range and
+ * an apply hook for the ones cached elsewhere; the others are read where
+ * they are used. A set from the shell takes effect right away and is saved,
+ * a reboot loads it back before the mesh starts publishing.
+ *
+ * Built with overlay-shell.conf, the shell shares the console UART:
+ *
+ *   tune show
+ *   tune set heartbeat 20
+ *   tune reset
+ *   dump nodes | links | timing | remote <addr>
+ */
+
+#include <zephyr.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/printk.h>
+#include <settings/settings.h>
+#include <shell/shell.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/mesh.h>
+#include <drivers/sensor.h>
+
+#include "mesh.h"
+#include "board.h"
+#include "mesh_app.h"
+#include "ttl_ctl.h"
+#include "relay_ctl.h"
+#include "power.h"
+#include "energy.h"
+#include "trace.h"
+#include "gateway.h"
+#include "diag.h"
+#include "tune.h"
+
+#define TUNE_TREE	"tune"
+
+#define THRESHOLD_DEFAULT	20
+#define PROXIMITY_DEFAULT	10
+#define ENV_FACTOR_DEFAULT	(2 * 10)
+#define SENSORS_DEFAULT_MS	1000
+#define DISPLAY_DEFAULT_MS	1000
+
+struct tune_param {
+	const char *name;
+	const char *unit;
+	uint16_t *val;
+	uint16_t def;
+	uint16_t min;
+	uint16_t max;
+	void (*apply)(void);
+};
+
+struct tune_params tune = {
+	.heartbeat_sec = HEARTBEAT_PERIOD_SEC,
+	.ttl = 0,
+	.acceptable_threshold = THRESHOLD_DEFAULT,
+	.proximity_delta = PROXIMITY_DEFAULT,
+	.environmental_factor = ENV_FACTOR_DEFAULT,
+	.sensor_interval_ms = SENSORS_DEFAULT_MS,
+	.display_interval_ms = DISPLAY_DEFAULT_MS,
+};
+
+static void ttl_apply(void)
+{
+	ttl_ctl_fix(tune.ttl);
+}
+
+static const struct tune_param params[] = {
+	{ "heartbeat", "s", &tune.heartbeat_sec, HEARTBEAT_PERIOD_SEC,
+	  1, 63, power_retune },
+	{ "ttl", "", &tune.ttl, 0, 0, MESH_TTL_MAX, ttl_apply },
+	{ "threshold", "", &tune.acceptable_threshold, THRESHOLD_DEFAULT,
+	  1, 100, NULL },
+	{ "proximity", "", &tune.proximity_delta, PROXIMITY_DEFAULT,
+	  1, 255, NULL },
+	{ "envfactor", "dB/decade", &tune.environmental_factor,
+	  ENV_FACTOR_DEFAULT, 10, 60, NULL },
+	{ "sensors", "ms", &tune.sensor_interval_ms, SENSORS_DEFAULT_MS,
+	  100, 60000, power_retune },
+	{ "display", "ms", &tune.display_interval_ms, DISPLAY_DEFAULT_MS,
+	  0, 60000, power_retune },
+};
+
+static const struct tune_param *param_find(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(params); i++) {
+		if (!strcmp(params[i].name, name)) {
+			return &params[i];
+		}
+	}
+
+	return NULL;
+}
+
+static int param_set(const struct tune_param *p, long val, bool save)
+{
+	char key[sizeof(TUNE_TREE "/") + 16];
+	uint16_t v;
+
+	if (val < p->min || val > p->max) {
+		return -ERANGE;
+	}
+
+	v = val;
+	*p->val = v;
+
+	if (p->apply) {
+		p->apply();
+	}
+
+	if (!save || !IS_ENABLED(CONFIG_SETTINGS)) {
+		return 0;
+	}
+
+	snprintk(key, sizeof(key), TUNE_TREE "/%s", p->name);
+
+	return settings_save_one(key, &v, sizeof(v));
+}
+
+static int tune_settings_set(const char *key, size_t len,
+			     settings_read_cb read_cb, void *cb_arg)
+{
+	const struct tune_param *p = param_find(key);
+	uint16_t val;
+
+	if (!p || len != sizeof(val)) {
+		return -ENOENT;
+	}
+
+	if (read_cb(cb_arg, &val, sizeof(val)) != sizeof(val)) {
+		return -EINVAL;
+	}
+
+	/* A stored value out of today's range keeps the default */
+	if (val >= p->min && val <= p->max) {
+		*p->val = val;
+	}
+
+	return 0;
+}
+
+static int tune_settings_commit(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(params); i++) {
+		if (params[i].apply && *params[i].val != params[i].def) {
+			params[i].apply();
+		}
+	}
+
+	return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(tune_settings, TUNE_TREE, NULL,
+			       tune_settings_set, tune_settings_commit, NULL);
+
+void tune_print(void)
+{
+	int i;
+
+	printk("Tuning:");
+	for (i = 0; i < ARRAY_SIZE(params); i++) {
+		printk(" %s %u%s%s", params[i].name, *params[i].val,
+		       params[i].unit, *params[i].val != params[i].def ? "*" :
+		       "");
+	}
+	printk("\n");
+}
+
+#ifdef CONFIG_SHELL
+static int cmd_tune_show(const struct shell *shell, size_t argc, char **argv)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(params); i++) {
+		const struct tune_param *p = &params[i];
+
+		shell_print(shell, "%-10s %5u %-9s default %u, %u to %u",
+			    p->name, *p->val, p->unit, p->def, p->min, p->max);
+	}
+
+	return 0;
+}
+
+static int cmd_tune_set(const struct shell *shell, size_t argc, char **argv)
+{
+	const struct tune_param *p = param_find(argv[1]);
+	char *end;
+	long val;
+	int err;
+
+	if (!p) {
+		shell_error(shell, "No parameter %s", argv[1]);
+		return -ENOENT;
+	}
+
+	val = strtol(argv[2], &end, 0);
+	if (*end) {
+		shell_error(shell, "Not a number: %s", argv[2]);
+		return -EINVAL;
+	}
+
+	err = param_set(p, val, true);
+	if (err == -ERANGE) {
+		shell_error(shell, "%s goes from %u to %u", p->name, p->min,
+			    p->max);
+	} else if (err) {
+		shell_error(shell, "Saving %s failed (err %d)", p->name, err);
+	}
+
+	return err;
+}
+
+static int cmd_tune_reset(const struct shell *shell, size_t argc, char **argv)
+{
+	int i, err;
+
+	for (i = 0; i < ARRAY_SIZE(params); i++) {
+		err = param_set(&params[i], params[i].def, true);
+		if (err) {
+			shell_error(shell, "Saving %s failed (err %d)",
+				    params[i].name, err);
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+static int cmd_dump_nodes(const struct shell *shell, size_t argc, char **argv)
+{
+	print_node_table();
+	print_ram_usage();
+
+	return 0;
+}
+
+static int cmd_dump_links(const struct shell *shell, size_t argc, char **argv)
+{
+	board_print_link_stats();
+	relay_ctl_print();
+	gateway_print();
+
+	return 0;
+}
+
+static int cmd_dump_timing(const struct shell *shell, size_t argc,
+			   char **argv)
+{
+	power_print();
+	energy_print();
+	trace_print();
+
+	return 0;
+}
+
+static int cmd_dump_remote(const struct shell *shell, size_t argc,
+			   char **argv)
+{
+	uint16_t addr = strtoul(argv[1], NULL, 16);
+	int err;
+
+	err = diag_poll(addr);
+	if (err) {
+		shell_error(shell, "A poll is running already");
+	}
+
+	return err;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(tune_cmds,
+	SHELL_CMD(show, NULL, "Show the parameters", cmd_tune_show),
+	SHELL_CMD_ARG(set, NULL, "<name> <value>", cmd_tune_set, 3, 0),
+	SHELL_CMD(reset, NULL, "Back to the defaults", cmd_tune_reset),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_STATIC_SUBCMD_SET_CREATE(dump_cmds,
+	SHELL_CMD(nodes, NULL, "Neighbor table", cmd_dump_nodes),
+	SHELL_CMD(links, NULL, "Link statistics", cmd_dump_links),
+	SHELL_CMD(timing, NULL, "Power, energy and latency", cmd_dump_timing),
+	SHELL_CMD_ARG(remote, NULL, "<addr> Stats of another node",
+		      cmd_dump_remote, 2, 0),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(tune, &tune_cmds, "Runtime parameters", NULL);
+SHELL_CMD_REGISTER(dump, &dump_cmds, "Node internals", NULL);
+#endif /* CONFIG_SHELL */
@@ -0,0 +1,25 @@
+/*
+ * Runtime tuning: the parameters of the distance estimate, the calibration
+ * and the active power level, settable from the shell and kept in settings
+ * under "tune/<name>". The other power levels scale with the active one.
+ */
+
+struct tune_params {
+	/* Heartbeat publish period at the active level, in s */
+	uint16_t heartbeat_sec;
+	/* Fixed send and publish TTL, 0 leaves it to the TTL controller */
+	uint16_t ttl;
+	/* Width of the proximity windows that start a calibration */
+	uint16_t acceptable_threshold;
+	/* Largest proximity difference of two boards held together */
+	uint16_t proximity_delta;
+	/* Ten times the path loss exponent, the dB per decade of distance */
+	uint16_t environmental_factor;
+	/* Sensor sampling and shortest redraw interval at the active level */
+	uint16_t sensor_interval_ms;
+	uint16_t display_interval_ms;
+};
+
+extern struct tune_params tune;
+
+void tune_print(void);
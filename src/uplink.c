@@ -0,0 +1,73 @@
+/*
+ * Uplink queue: fixed size FIFO of node records waiting for the gateway
+ * consumer. A stalled consumer costs the oldest records, never memory or
+ * time on the producer side.
+ */
+
+#include <zephyr/types.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#include "uplink.h"
+
+void uplink_queue_init(struct uplink_queue *q)
+{
+	memset(q, 0, sizeof(*q));
+}
+
+int uplink_queue_put(struct uplink_queue *q, uint16_t addr,
+		     const uint8_t *data, uint8_t len)
+{
+	struct uplink_record *rec = NULL;
+	uint8_t i;
+
+	if (len > sizeof(rec->data)) {
+		return -EMSGSIZE;
+	}
+
+	for (i = 0; i < q->count; i++) {
+		struct uplink_record *queued =
+			&q->records[(q->head + i) % UPLINK_QUEUE_SIZE];
+
+		if (queued->addr == addr) {
+			/* Only the latest record of a node is worth sending */
+			rec = queued;
+			q->coalesced++;
+			break;
+		}
+	}
+
+	if (!rec) {
+		if (q->count == UPLINK_QUEUE_SIZE) {
+			q->head = (q->head + 1) % UPLINK_QUEUE_SIZE;
+			q->count--;
+			q->dropped++;
+		}
+
+		rec = &q->records[(q->head + q->count) % UPLINK_QUEUE_SIZE];
+		q->count++;
+		if (q->count > q->high_water) {
+			q->high_water = q->count;
+		}
+	}
+
+	rec->addr = addr;
+	rec->len = len;
+	memcpy(rec->data, data, len);
+
+	return 0;
+}
+
+bool uplink_queue_get(struct uplink_queue *q, struct uplink_record *rec)
+{
+	if (!q->count) {
+		return false;
+	}
+
+	memcpy(rec, &q->records[q->head], sizeof(*rec));
+	q->head = (q->head + 1) % UPLINK_QUEUE_SIZE;
+	q->count--;
+
+	return true;
+}
@@ -0,0 +1,30 @@
+/*
+ * Uplink queue: fixed size FIFO of node records waiting for the gateway
+ * consumer. An update for an address already queued replaces the queued
+ * record in place, and when the queue is full the oldest record is dropped.
+ * The queue does no locking of its own.
+ */
+
+#define UPLINK_QUEUE_SIZE	CONFIG_APP_UPLINK_QUEUE_SIZE
+#define UPLINK_RECORD_MAX	CONFIG_APP_UPLINK_RECORD_SIZE
+
+struct uplink_record {
+	uint16_t addr;
+	uint8_t len;
+	uint8_t data[UPLINK_RECORD_MAX];
+};
+
+struct uplink_queue {
+	struct uplink_record records[UPLINK_QUEUE_SIZE];
+	uint8_t head;
+	uint8_t count;
+	/* Most records ever queued at once */
+	uint8_t high_water;
+	uint32_t coalesced;
+	uint32_t dropped;
+};
+
+void uplink_queue_init(struct uplink_queue *q);
+int uplink_queue_put(struct uplink_queue *q, uint16_t addr,
+		     const uint8_t *data, uint8_t len);
+bool uplink_queue_get(struct uplink_queue *q, struct uplink_record *rec);
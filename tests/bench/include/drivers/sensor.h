@@ -0,0 +1,2 @@
+/* Host stand-in, board.h only passes sensor values by pointer */
+struct sensor_value;
@@ -0,0 +1,3 @@
+/* Host stand-ins, printk() writes to stdout, see stubs.c */
+void printk(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+int snprintk(char *str, size_t size, const char *fmt, ...);
@@ -0,0 +1,42 @@
+/*
+ * The part of the kernel API used by the message path, on the host. The
+ * cycle counter counts nanoseconds of CLOCK_MONOTONIC, see stubs.c.
+ */
+
+#ifndef BENCH_ZEPHYR_H
+#define BENCH_ZEPHYR_H
+
+#include <zephyr/types.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/printk.h>
+
+#define ARRAY_SIZE(array)	(sizeof(array) / sizeof((array)[0]))
+#define MIN(a, b)		(((a) < (b)) ? (a) : (b))
+#define MAX(a, b)		(((a) > (b)) ? (a) : (b))
+#define CLAMP(val, low, high)	(((val) <= (low)) ? (low) : MIN(val, high))
+#define BIT(n)			(1UL << (n))
+#define ceiling_fraction(numerator, divider) \
+	(((numerator) + ((divider) - 1)) / (divider))
+
+#define BUILD_ASSERT(cond, msg)	_Static_assert(cond, msg)
+
+typedef struct {
+	int64_t ticks;
+} k_timeout_t;
+
+uint32_t k_cycle_get_32(void);
+uint32_t k_uptime_get_32(void);
+
+static inline uint64_t k_cyc_to_ns_floor64(uint64_t cyc)
+{
+	return cyc;
+}
+
+static inline uint64_t k_cyc_to_ns_ceil64(uint64_t cyc)
+{
+	return cyc;
+}
+
+#endif
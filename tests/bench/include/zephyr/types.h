@@ -0,0 +1,2 @@
+/* Host stand-in, the message path only needs the fixed width types */
+#include <stdint.h>
@@ -0,0 +1,14 @@
+/*
+ * The benchmark of src/bench.c on the host, with the cycle counter counting
+ * nanoseconds. Built with the default capacities of Kconfig, see the
+ * Makefile.
+ */
+
+#include "bench.h"
+
+int main(void)
+{
+	bench_run();
+
+	return 0;
+}
@@ -0,0 +1,2 @@
+/* Host stand-in, the uplink queue only needs the fixed width types */
+#include <stdint.h>
@@ -0,0 +1,202 @@
+/*
+ * Uplink queue with a stalled consumer: the producer keeps putting records
+ * while nothing is taken out, then the consumer resumes. Built with a queue
+ * of 4 records, see the Makefile.
+ */
+
+#include <zephyr/types.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "uplink.h"
+
+static int failures;
+
+#define CHECK(cond)							\
+	do {								\
+		if (!(cond)) {						\
+			printf("%s:%d: %s\n", __func__, __LINE__, #cond); \
+			failures++;					\
+		}							\
+	} while (0)
+
+static struct uplink_queue q;
+
+static void put(uint16_t addr, uint8_t val)
+{
+	CHECK(uplink_queue_put(&q, addr, &val, 1) == 0);
+}
+
+/* Takes the next record, which must be addr with val */
+static void expect(uint16_t addr, uint8_t val)
+{
+	struct uplink_record rec;
+
+	CHECK(uplink_queue_get(&q, &rec));
+	CHECK(rec.addr == addr);
+	CHECK(rec.len == 1 && rec.data[0] == val);
+}
+
+static void expect_empty(void)
+{
+	struct uplink_record rec;
+
+	CHECK(!uplink_queue_get(&q, &rec));
+}
+
+static void test_coalesce(void)
+{
+	uplink_queue_init(&q);
+
+	put(1, 10);
+	put(2, 20);
+	put(1, 11);
+
+	/* The update replaces the queued record in its place */
+	CHECK(q.count == 2);
+	CHECK(q.coalesced == 1);
+	expect(1, 11);
+	expect(2, 20);
+	expect_empty();
+}
+
+static void test_drop_oldest(void)
+{
+	uint16_t addr;
+
+	uplink_queue_init(&q);
+
+	for (addr = 1; addr <= 6; addr++) {
+		put(addr, addr);
+	}
+
+	CHECK(q.count == UPLINK_QUEUE_SIZE);
+	CHECK(q.dropped == 2);
+
+	for (addr = 3; addr <= 6; addr++) {
+		expect(addr, addr);
+	}
+
+	expect_empty();
+}
+
+static void test_high_water(void)
+{
+	uplink_queue_init(&q);
+
+	put(1, 1);
+	put(2, 2);
+	expect(1, 1);
+	put(3, 3);
+
+	CHECK(q.high_water == 2);
+
+	put(4, 4);
+	put(5, 5);
+	put(6, 6);
+
+	CHECK(q.high_water == UPLINK_QUEUE_SIZE);
+
+	/* Draining doesn't lower it */
+	while (q.count) {
+		struct uplink_record rec;
+
+		uplink_queue_get(&q, &rec);
+	}
+
+	CHECK(q.high_water == UPLINK_QUEUE_SIZE);
+}
+
+static void test_wraparound(void)
+{
+	uplink_queue_init(&q);
+
+	put(1, 1);
+	put(2, 2);
+	put(3, 3);
+	expect(1, 1);
+	expect(2, 2);
+
+	/* Records 5 and 6 go in at the start of the array */
+	put(4, 4);
+	put(5, 5);
+	put(6, 6);
+
+	CHECK(q.head == 2);
+	CHECK(q.count == 4);
+
+	/* Coalescing finds a record past the end of the array */
+	put(5, 55);
+	CHECK(q.count == 4);
+
+	/* And a full wrapped queue drops its oldest */
+	put(7, 7);
+	CHECK(q.dropped == 1);
+
+	expect(4, 4);
+	expect(5, 55);
+	expect(6, 6);
+	expect(7, 7);
+	expect_empty();
+}
+
+static void test_stall_and_resume(void)
+{
+	uint32_t dropped;
+	int i;
+
+	uplink_queue_init(&q);
+
+	/* 10 nodes keep reporting, nobody drains */
+	for (i = 0; i < 100; i++) {
+		put(1 + i % 10, i);
+	}
+
+	CHECK(q.count == UPLINK_QUEUE_SIZE);
+	CHECK(q.dropped + UPLINK_QUEUE_SIZE == 100);
+
+	/* The newest records are the ones left */
+	for (i = 96; i < 100; i++) {
+		expect(1 + i % 10, i);
+	}
+
+	expect_empty();
+
+	/* Back to normal, records flow through without losses */
+	dropped = q.dropped;
+
+	for (i = 0; i < 20; i++) {
+		put(1 + i % 3, i);
+		expect(1 + i % 3, i);
+	}
+
+	CHECK(q.dropped == dropped);
+	expect_empty();
+}
+
+static void test_too_long(void)
+{
+	uint8_t data[UPLINK_RECORD_MAX + 1] = { 0 };
+
+	uplink_queue_init(&q);
+
+	CHECK(uplink_queue_put(&q, 1, data, sizeof(data)) == -EMSGSIZE);
+	CHECK(uplink_queue_put(&q, 1, data, UPLINK_RECORD_MAX) == 0);
+	CHECK(q.count == 1);
+}
+
+int main(void)
+{
+	test_coalesce();
+	test_drop_oldest();
+	test_high_water();
+	test_wraparound();
+	test_stall_and_resume();
+	test_too_long();
+
+	printf("uplink: %s\n", failures ? "FAILED" : "passed");
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,221 @@
+#!/usr/bin/env python3
+"""Decode the gateway frames streamed on the board console into a live table.
+
+Usage: gateway_decode.py [/dev/ttyACM0 [baudrate]]   (reads stdin without a port)
+
+The frames are mixed with the console text, so the stream is scanned for the
+sync bytes and every frame is checked against its CRC before it is used.
+See src/gateway.h for the frame layout.
+"""
+
+import struct
+import sys
+import time
+
+SYNC = b"\xaa\x55"
+FRAME_NODE = 0x01
+FRAME_AGGREGATE = 0x02
+FRAME_LATENCY = 0x03
+FRAME_HEALTH = 0x04
+
+# Diagnostic pages, see src/diag.h
+DIAG_PAGE_SIZE = 7
+DIAG_PAGES_FIXED = 4
+
+# Upper bounds of the latency bins in ms, the last one is 1 s and more
+LATENCY_BINS = ("<16", "<32", "<64", "<128", "<256", "<512", "<1024", ">=1024")
+# Percentile reported for the last bin, see TRACE_LATENCY_OPEN in src/trace.h
+LATENCY_OPEN = 0xffff
+
+
+def crc16_ccitt(seed, data):
+    """Same as crc16_ccitt() in Zephyr's sys/crc.h."""
+    for byte in data:
+        e = (seed ^ byte) & 0xff
+        f = (e ^ (e << 4)) & 0xff
+        seed = ((seed >> 8) ^ (f << 8) ^ (f << 3) ^ (f >> 4)) & 0xffff
+    return seed
+
+
+def frames(read):
+    buf = bytearray()
+    while True:
+        chunk = read()
+        if not chunk:
+            return
+        buf += chunk
+        while True:
+            start = buf.find(SYNC)
+            if start < 0:
+                del buf[:-1]
+                break
+            del buf[:start]
+            if len(buf) < 4:
+                break
+            length, kind = buf[2], buf[3]
+            if len(buf) < 4 + length + 2:
+                break
+            payload = bytes(buf[4:4 + length])
+            crc, = struct.unpack_from("<H", buf, 4 + length)
+            if crc16_ccitt(0xffff, buf[2:4 + length]) != crc:
+                # Sync bytes inside the console text, skip them
+                del buf[:1]
+                continue
+            del buf[:4 + length + 2]
+            yield kind, payload
+
+
+def decode_node(payload):
+    addr, rssi, temp, hum, dist, count = struct.unpack_from("<HbhBBB", payload)
+    neighbors = [struct.unpack_from("<HB", payload, 8 + 3 * i)
+                 for i in range(count)]
+    return addr, {
+        "rssi": rssi,
+        "temperature": temp / 100,
+        "humidity": hum,
+        "distance": dist / 10,
+        "neighbors": neighbors,
+        "seen": time.time(),
+    }
+
+
+def decode_aggregate(payload):
+    nodes, tmin, tmax, tsum, count = struct.unpack_from("<BhhiB", payload)
+    edges = [struct.unpack_from("<HHB", payload, 10 + 5 * i)
+             for i in range(count)]
+    return {
+        "nodes": nodes,
+        "min": tmin / 100,
+        "max": tmax / 100,
+        "avg": tsum / nodes / 100 if nodes else 0,
+        "edges": edges,
+    }
+
+
+def decode_latency(payload, latency):
+    """Merge a frame into latency, a report may span several frames."""
+    hop_count = payload[0]
+    bins = len(LATENCY_BINS)
+    hops = [list(payload[1 + bins * i:1 + bins * (i + 1)])
+            for i in range(hop_count)]
+    offset = 1 + bins * hop_count
+    _, first, count = struct.unpack_from("<BBB", payload, offset)
+    sources = [struct.unpack_from("<HHH", payload, offset + 3 + 6 * i)
+               for i in range(count)]
+    if first == 0 or not latency:
+        latency = {"sources": {}}
+    latency["hops"] = hops
+    latency["sources"].update((a, (p50, p90)) for a, p50, p90 in sources)
+    return latency
+
+
+def decode_health(payload):
+    addr, count = struct.unpack_from("<HB", payload)
+    pages = [payload[3 + DIAG_PAGE_SIZE * i:3 + DIAG_PAGE_SIZE * (i + 1)]
+             for i in range(count)]
+    if count < DIAG_PAGES_FIXED:
+        return addr, None
+    _, neighbors, senders, level, calibrated, uptime = \
+        struct.unpack("<BBBBBH", pages[0])
+    received, expected, duplicates, stale = struct.unpack("<HHHB", pages[1])
+    sent, relayed, allocs, ttl = struct.unpack("<HHHB", pages[2])
+    log_max, log_lost, uplink_max, uplink_dropped, uart_max = \
+        struct.unpack("<BHBHB", pages[3])
+    return addr, {
+        "uptime": uptime,
+        "level": level,
+        "neighbors": neighbors,
+        "calibrated": calibrated,
+        "senders": senders,
+        "received": received,
+        "expected": expected,
+        "duplicates": duplicates,
+        "stale": stale,
+        "sent": sent,
+        "relayed": relayed,
+        "allocs": allocs,
+        "ttl": ttl,
+        "log": (log_max, log_lost),
+        "uplink": (uplink_max, uplink_dropped),
+        "uart": uart_max * 8,
+    }
+
+
+def draw(nodes, aggregate, latency, health):
+    out = ["\x1b[H\x1b[2J",
+           "addr   temp  hum  rssi  dist  age  p50  p90  neighbors"]
+    sources = latency["sources"] if latency else {}
+    now = time.time()
+    for addr in sorted(nodes):
+        n = nodes[addr]
+        neighbors = " ".join("%04x:%.1f" % (a, d / 10) for a, d in n["neighbors"])
+        p50, p90 = (LATENCY_BINS[-1] if p == LATENCY_OPEN else str(p)
+                    for p in sources.get(addr, (0, 0)))
+        out.append("%04x %6.2f %4d %5d %5.1f %4d %4s %4s  %s" % (
+            addr, n["temperature"], n["humidity"], n["rssi"], n["distance"],
+            now - n["seen"], p50, p90, neighbors))
+    if aggregate:
+        out.append("")
+        out.append("sink: %(nodes)d nodes, %(min).2f/%(avg).2f/%(max).2f C "
+                   "(min/avg/max)" % aggregate)
+        out.append("edges: " + " ".join("%04x-%04x:%.1f" % (a, b, d / 10)
+                                         for a, b, d in aggregate["edges"]))
+    if health:
+        out.append("")
+        out.append("health    up  lvl nbrs    recv/exp  dup stale  sent "
+                   "relay ttl log   uplink uart")
+        for addr in sorted(health):
+            h = health[addr]
+            out.append("%04x %5dm %4d %2d/%-2d %5d/%-5d %3d %5d %5d %5d %3d "
+                       "%2d/%-2d %2d/%-3d %5d" % (
+                           addr, h["uptime"], h["level"], h["calibrated"],
+                           h["neighbors"], h["received"], h["expected"],
+                           h["duplicates"], h["stale"], h["sent"],
+                           h["relayed"], h["ttl"], h["log"][0], h["log"][1],
+                           h["uplink"][0], h["uplink"][1], h["uart"]))
+    if latency:
+        out.append("")
+        out.append("latency ms  " + " ".join("%6s" % b for b in LATENCY_BINS))
+        for i, hist in enumerate(latency["hops"]):
+            label = "%d hop%s" % (i + 1, "" if i == 0 else "s")
+            if i == len(latency["hops"]) - 1:
+                label = "%d+ hops" % (i + 1)
+            out.append("%-11s " % label +
+                       " ".join("%6d" % n for n in hist))
+    sys.stdout.write("\n".join(out) + "\n")
+    sys.stdout.flush()
+
+
+def main():
+    if len(sys.argv) > 1:
+        import serial
+        port = serial.Serial(sys.argv[1],
+                             int(sys.argv[2]) if len(sys.argv) > 2 else 115200,
+                             timeout=1)
+        read = lambda: port.read(256) or b" "
+    else:
+        read = lambda: sys.stdin.buffer.read1(256)
+
+    nodes, aggregate, latency, health = {}, None, None, {}
+    for kind, payload in frames(read):
+        try:
+            if kind == FRAME_NODE:
+                addr, node = decode_node(payload)
+                nodes[addr] = node
+            elif kind == FRAME_AGGREGATE:
+                aggregate = decode_aggregate(payload)
+            elif kind == FRAME_LATENCY:
+                latency = decode_latency(payload, latency)
+            elif kind == FRAME_HEALTH:
+                addr, h = decode_health(payload)
+                if h:
+                    health[addr] = h
+            else:
+                continue
+        except (struct.error, IndexError):
+            continue
+        draw(nodes, aggregate, latency, health)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,141 @@
+#!/usr/bin/env python3
+"""Delivery ratio against transmissions of the relay election.
+
+Usage: relay_sim.py [--runs N] [--seed S] [--area WxH] [NODES...]
+
+Places the nodes at random in a hall, 60 x 40 m by default, and floods one
+heartbeat from every node, once with every node relaying and once with the
+relays elected the way src/relay_ctl.c does. The election uses the same
+rules and constants: direct neighbors at or above RELAY_RSSI_MIN count, a
+node with fewer than RELAY_DENSE_NEIGHBORS of them relays, otherwise only
+the RELAY_ELECTED nodes ranked highest by the address hash do. A node keeps
+at most RELAY_NEIGHBORS_MAX neighbors, like its table.
+
+The radio is a log-distance model with the default environmental factor of
+the distance estimate, a few dB of shadowing per link and a reception
+probability that falls from 1 at -85 dBm to 0 at -95 dBm. Every node relays
+a message at most once (the message cache) and there is no TTL limit and no
+collision model, so the numbers compare the two policies rather than
+predict a real hall.
+"""
+
+import argparse
+import math
+import random
+
+RELAY_DENSE_NEIGHBORS = 6
+RELAY_ELECTED = 3
+RELAY_RSSI_MIN = -90
+RELAY_NEIGHBORS_MAX = 32
+
+# RSSI at 1 m and 10 times the path loss exponent, see tune.c
+RSSI_1M = -59
+ENV_FACTOR = 20
+SHADOWING_DB = 4
+
+RX_SURE = -85
+RX_NONE = -95
+
+
+def rank_key(addr):
+    return (addr * 0x9E37) & 0xFFFF
+
+
+def layout(count, area, rng):
+    addrs = rng.sample(range(1, 0x8000), count)
+    pos = [(rng.uniform(0, area[0]), rng.uniform(0, area[1]))
+           for _ in range(count)]
+    rssi = [[None] * count for _ in range(count)]
+    for a in range(count):
+        for b in range(a + 1, count):
+            d = max(math.dist(pos[a], pos[b]), 0.1)
+            r = RSSI_1M - ENV_FACTOR * math.log10(d) + \
+                rng.gauss(0, SHADOWING_DB)
+            rssi[a][b] = rssi[b][a] = r
+    return addrs, rssi
+
+
+def rx_prob(r):
+    if r >= RX_SURE:
+        return 1.0
+    if r <= RX_NONE:
+        return 0.0
+    return (r - RX_NONE) / (RX_SURE - RX_NONE)
+
+
+def elect(addrs, rssi, rng):
+    relays = []
+    for a, own in enumerate(addrs):
+        heard = [b for b in range(len(addrs))
+                 if b != a and rssi[a][b] >= RELAY_RSSI_MIN]
+        # The table keeps the ones heard last, any of them
+        if len(heard) > RELAY_NEIGHBORS_MAX:
+            heard = rng.sample(heard, RELAY_NEIGHBORS_MAX)
+        above = sum(rank_key(addrs[b]) > rank_key(own) for b in heard)
+        relays.append(len(heard) < RELAY_DENSE_NEIGHBORS or
+                      above < RELAY_ELECTED)
+    return relays
+
+
+def flood(source, relays, rssi, rng):
+    """Returns the nodes reached and the transmissions it took"""
+    reached = {source}
+    queue = [source]
+    tx = 0
+    while queue:
+        sender = queue.pop(0)
+        tx += 1
+        for b in range(len(relays)):
+            if b in reached or rng.random() >= rx_prob(rssi[sender][b]):
+                continue
+            reached.add(b)
+            if relays[b]:
+                queue.append(b)
+    return len(reached) - 1, tx
+
+
+def run(count, area, runs, rng):
+    totals = {"all": [0, 0], "elected": [0, 0]}
+    relay_count = 0
+    for _ in range(runs):
+        addrs, rssi = layout(count, area, rng)
+        policies = {"all": [True] * count,
+                    "elected": elect(addrs, rssi, rng)}
+        relay_count += sum(policies["elected"])
+        for name, relays in policies.items():
+            for source in range(count):
+                reached, tx = flood(source, relays, rssi, rng)
+                totals[name][0] += reached
+                totals[name][1] += tx
+    floods = runs * count
+    return {
+        "relays": relay_count / runs,
+        "all": (totals["all"][0] / (floods * (count - 1)),
+                totals["all"][1] / floods),
+        "elected": (totals["elected"][0] / (floods * (count - 1)),
+                    totals["elected"][1] / floods),
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--runs", type=int, default=20)
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--area", default="60x40")
+    parser.add_argument("nodes", type=int, nargs="*", default=[20, 50, 100])
+    args = parser.parse_args()
+
+    area = tuple(float(v) for v in args.area.split("x"))
+    rng = random.Random(args.seed)
+
+    print("%5s %7s | %8s %6s | %8s %6s" %
+          ("nodes", "relays", "all", "tx/hb", "elected", "tx/hb"))
+    for count in args.nodes:
+        r = run(count, area, args.runs, rng)
+        print("%5u %7.1f | %7.1f%% %6.1f | %7.1f%% %6.1f" %
+              (count, r["relays"], 100 * r["all"][0], r["all"][1],
+               100 * r["elected"][0], r["elected"][1]))
+
+
+if __name__ == "__main__":
+    main()
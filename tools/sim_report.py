@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+"""Summarize a testbed run from the console logs of its nodes.
+
+Usage: sim_report.py LOG [LOG...]
+
+Every node built with MESH_SIM prints a "sim," CSV line once a minute, see
+src/sim.c. The logs may hold one node each or several nodes interleaved; the
+latest line of every node is used. Prints one row per node and the totals:
+heartbeat delivery ratio, transmissions, air time, app work time and end-to-end
+heartbeat latency. The latency needs MESH_TRACE, nodes without it report 0
+and are left out; the values are upper bounds of histogram bins, and the
+last bin, 1024 ms and more, shows as "1s+".
+"""
+
+import sys
+
+FIELDS = ("addr", "uptime_s", "hb_received", "hb_expected", "tx_pdus",
+          "tx_bytes", "airtime_ms", "work_ms", "relayed", "latency_p50_ms",
+          "latency_p90_ms")
+
+# Air time in src/sim.c covers the three advertising channels
+CHANNELS = 3
+# Percentile of the last latency bin, see TRACE_LATENCY_OPEN in src/trace.h
+LATENCY_OPEN = 0xffff
+
+
+def parse(paths):
+    nodes = {}
+    for path in paths:
+        with open(path, errors="replace") as log:
+            for line in log:
+                start = line.find("sim,")
+                if start < 0:
+                    continue
+                values = line[start:].strip().split(",")[1:]
+                if len(values) != len(FIELDS) or values[0] == "addr":
+                    continue
+                try:
+                    rec = dict(zip(FIELDS[1:], map(int, values[1:])))
+                except ValueError:
+                    continue
+                nodes[values[0]] = rec
+    return nodes
+
+
+def latency(ms):
+    return "1s+" if ms == LATENCY_OPEN else "%u" % ms
+
+
+def ratio(num, den):
+    return num / den if den else 0.0
+
+
+def main(paths):
+    nodes = parse(paths)
+    if not nodes:
+        sys.exit("no sim lines found")
+
+    print("%-6s %8s %10s %8s %8s %10s %8s %8s %12s" %
+          ("node", "uptime", "delivery", "tx", "bytes", "airtime", "work",
+           "relayed", "p50/p90 ms"))
+
+    for addr, n in sorted(nodes.items()):
+        print("%-6s %7us %9.1f%% %8u %8u %8ums %6ums %8u %12s" %
+              (addr, n["uptime_s"],
+               100 * ratio(n["hb_received"], n["hb_expected"]),
+               n["tx_pdus"], n["tx_bytes"], n["airtime_ms"], n["work_ms"],
+               n["relayed"],
+               "%s/%s" % (latency(n["latency_p50_ms"]),
+                          latency(n["latency_p90_ms"]))))
+
+    total = {f: sum(n[f] for n in nodes.values()) for f in FIELDS[1:]}
+    uptime_ms = max(n["uptime_s"] for n in nodes.values()) * 1000
+
+    print()
+    print("nodes            %u" % len(nodes))
+    print("delivery ratio   %.1f%%" %
+          (100 * ratio(total["hb_received"], total["hb_expected"])))
+    print("transmissions    %u sent, %u relayed" %
+          (total["tx_pdus"], total["relayed"]))
+    print("channel busy     %.2f%% of the time" %
+          (100 * ratio(total["airtime_ms"], uptime_ms * CHANNELS)))
+    print("work per node    %.0f ms average, %u ms max" %
+          (total["work_ms"] / len(nodes),
+           max(n["work_ms"] for n in nodes.values())))
+
+    traced = sorted(n["latency_p50_ms"] for n in nodes.values()
+                    if n["latency_p50_ms"])
+    if traced:
+        print("latency          p50 %s ms median node, p90 %s ms worst node" %
+              (latency(traced[len(traced) // 2]),
+               latency(max(n["latency_p90_ms"] for n in nodes.values()))))
+    else:
+        print("latency          not traced, build with MESH_TRACE")
+
+
+if __name__ == "__main__":
+    if len(sys.argv) < 2:
+        sys.exit(__doc__)
+    main(sys.argv[1:])